@@ -0,0 +1,461 @@
+// End-to-end loopback UDP echo benchmark.
+//
+//   bench [--sizes 64,512,1400] [--threads 1,2,4] [--paths epoll,batch]
+//         [--window 32] [--seconds 2] [--warmup 0.25] [--out results.json]
+//
+// Every combination of payload size, thread count and path is one run. A run starts
+// 'threads' independent echo pairs: a server thread (server_socket_udp() + Epoll,
+// sending each datagram back where it came from) and a client thread
+// (client_socket_udp() + Epoll) keeping 'window' datagrams in flight. Each datagram
+// carries its send time, so every echo is one round trip time sample.
+//
+// Paths:
+//   epoll   one recvfrom()/sendto() (server) or recv()/send() (client) per datagram
+//   batch   recvmmsg()/sendmmsg() with MsgBatch, up to 32 datagrams per call
+//
+// Throughput is echoes received by the clients per second; Gbit/s counts their
+// payload only. Datagrams not echoed within 'loss_timeout' are counted as lost and
+// replaced. Results are written as JSON (to stdout without --out), a summary line
+// per run goes to stderr.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <unix/inet.hpp>
+#include <unix/epoll.hpp>
+
+namespace unix = _unix;
+
+using unix::inet::Socket;
+using unix::inet::RecvFlag;
+using unix::epoll::Epoll;
+using unix::epoll::EpollEventType;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr size_t batch_size   = 32;
+constexpr size_t max_payload  = 65000;
+constexpr auto   loss_timeout = std::chrono::milliseconds(20);
+
+using Batch = unix::inet::MsgBatch<batch_size>;
+
+enum class Path { Epoll, Batch };
+
+const char * path_name(Path p){
+    return (p == Path::Epoll) ? "epoll" : "batch";
+}
+
+struct Config {
+    std::vector<size_t>   sizes   = {64, 512, 1400};
+    std::vector<unsigned> threads = {1, 2, 4};
+    std::vector<Path>     paths   = {Path::Epoll, Path::Batch};
+    size_t      window  = 32;
+    double      seconds = 2.0;
+    double      warmup  = 0.25;
+    std::string out;
+};
+
+// Phases of a run, shared by all its threads
+enum Phase { Warmup, Measure, Stop };
+
+// Per client results; RTT samples in nanoseconds
+struct ClientStats {
+    uint64_t              echoes = 0;
+    uint64_t              lost   = 0;
+    std::vector<uint32_t> rtt;
+};
+
+uint64_t now_ns(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+void stamp(uint8_t * buf){
+    uint64_t t = now_ns();
+    memcpy(buf, &t, sizeof(t));
+}
+
+uint32_t rtt_of(const uint8_t * buf){
+    uint64_t t;
+    memcpy(&t, buf, sizeof(t));
+    return static_cast<uint32_t>(std::min<uint64_t>(now_ns() - t, UINT32_MAX));
+}
+
+// ----------------------------------------------------------------------------
+// Server side
+
+void serve_epoll(Socket & s, const std::atomic<int> & phase){
+    Epoll ep;
+    ep.add(s, {EpollEventType::Input});
+    unix::epoll::EventList<4> evl;
+    std::vector<uint8_t> buf(max_payload);
+
+    while(phase.load(std::memory_order_relaxed) != Stop){
+        if(ep.wait(evl, Epoll::MilliSeconds(10)) <= 0){
+            continue;
+        }
+        while(true){
+            auto r = s.recvfrom(buf.data(), buf.size(), {RecvFlag::DontWait});
+            if(r.first < 0 || !r.second){
+                break;
+            }
+            s.sendto(buf.data(), r.first, *r.second);
+        }
+    }
+}
+
+void serve_batch(Socket & s, const std::atomic<int> & phase){
+    Epoll ep;
+    ep.add(s, {EpollEventType::Input});
+    unix::epoll::EventList<4> evl;
+    std::vector<uint8_t> mem(batch_size * max_payload);
+    Batch batch;
+    for(size_t i = 0; i < batch_size; ++i){
+        batch.set_buffer(i, &mem[i * max_payload], max_payload);
+    }
+
+    while(phase.load(std::memory_order_relaxed) != Stop){
+        if(ep.wait(evl, Epoll::MilliSeconds(10)) <= 0){
+            continue;
+        }
+        while(s.recvmmsg(batch, {RecvFlag::DontWait}) > 0){
+            // Lengths and source addresses are kept, so the batch goes straight back
+            size_t sent = 0;
+            while(sent < batch.size()){
+                int n = s.sendmmsg(batch, sent);
+                if(n <= 0){
+                    break;
+                }
+                sent += n;
+            }
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Client side
+
+void client_epoll(Socket & s, size_t payload, size_t window, const std::atomic<int> & phase, ClientStats & st){
+    Epoll ep;
+    ep.add(s, {EpollEventType::Input});
+    unix::epoll::EventList<4> evl;
+    std::vector<uint8_t> out(payload), in(max_payload);
+
+    size_t inflight = 0;
+    auto   last_rx  = Clock::now();
+    int    p;
+    while((p = phase.load(std::memory_order_relaxed)) != Stop){
+        for(; inflight < window; ++inflight){
+            stamp(out.data());
+            if(s.send(out.data(), payload) < 0){
+                break;
+            }
+        }
+        if(ep.wait(evl, Epoll::MilliSeconds(1)) > 0){
+            ssize_t n;
+            while((n = s.recv(in.data(), in.size(), {RecvFlag::DontWait})) >= 0){
+                if(size_t(n) >= sizeof(uint64_t) && p == Measure){
+                    st.rtt.push_back(rtt_of(in.data()));
+                    ++st.echoes;
+                }
+                inflight -= (inflight > 0);
+                last_rx = Clock::now();
+            }
+        }
+        else if(inflight > 0 && Clock::now() - last_rx > loss_timeout){
+            st.lost += (p == Measure) ? inflight : 0;
+            inflight = 0;
+            last_rx  = Clock::now();
+        }
+    }
+}
+
+void client_batch(Socket & s, size_t payload, size_t window, const std::atomic<int> & phase, ClientStats & st){
+    Epoll ep;
+    ep.add(s, {EpollEventType::Input});
+    unix::epoll::EventList<4> evl;
+
+    std::vector<uint8_t> tx_mem(batch_size * payload), rx_mem(batch_size * max_payload);
+    Batch tx, rx;
+    for(size_t i = 0; i < batch_size; ++i){
+        tx.set_buffer(i, &tx_mem[i * payload], payload);
+        rx.set_buffer(i, &rx_mem[i * max_payload], max_payload);
+    }
+
+    size_t inflight = 0;
+    auto   last_rx  = Clock::now();
+    int    p;
+    while((p = phase.load(std::memory_order_relaxed)) != Stop){
+        while(inflight < window){
+            size_t k = std::min(window - inflight, batch_size);
+            tx.resize(k);
+            for(size_t i = 0; i < k; ++i){
+                stamp(tx.data(i));
+                tx.set_length(i, payload);
+                tx.clear_address(i);
+            }
+            int n = s.sendmmsg(tx);
+            if(n <= 0){
+                break;
+            }
+            inflight += n;
+        }
+        if(ep.wait(evl, Epoll::MilliSeconds(1)) > 0){
+            int n;
+            while((n = s.recvmmsg(rx, {RecvFlag::DontWait})) > 0){
+                for(int i = 0; i < n; ++i){
+                    if(rx.length(i) >= sizeof(uint64_t) && p == Measure){
+                        st.rtt.push_back(rtt_of(rx.data(i)));
+                        ++st.echoes;
+                    }
+                }
+                inflight -= std::min<size_t>(inflight, n);
+                last_rx = Clock::now();
+            }
+        }
+        else if(inflight > 0 && Clock::now() - last_rx > loss_timeout){
+            st.lost += (p == Measure) ? inflight : 0;
+            inflight = 0;
+            last_rx  = Clock::now();
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Runs and reporting
+
+struct Result {
+    Path     path;
+    size_t   payload;
+    unsigned threads;
+    size_t   window;
+    double   seconds;
+    uint64_t echoes;
+    uint64_t lost;
+    double   pps;
+    double   gbps;
+    // min, p50, p90, p99, p99.9, max
+    std::array<uint32_t, 6> latency;
+};
+
+uint32_t percentile(std::vector<uint32_t> & v, double q){
+    if(v.empty()){
+        return 0;
+    }
+    size_t k = std::min(v.size() - 1, static_cast<size_t>(q * v.size()));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+bool run(const Config & cfg, Path path, size_t payload, unsigned threads, Result & res){
+    std::vector<Socket>      servers;
+    std::vector<Socket>      clients;
+    std::vector<ClientStats> stats(threads);
+
+    for(unsigned i = 0; i < threads; ++i){
+        auto srv = unix::inet::server_socket_udp("127.0.0.1", "0");
+        if(!srv){
+            return false;
+        }
+        auto addr = srv->getsockname();
+        if(!addr){
+            return false;
+        }
+        auto cli = unix::inet::client_socket_udp("127.0.0.1", std::to_string(addr->port()));
+        if(!cli){
+            return false;
+        }
+        servers.push_back(std::move(*srv));
+        clients.push_back(std::move(*cli));
+        stats[i].rtt.reserve(1 << 20);
+    }
+
+    std::atomic<int> phase(Warmup);
+    std::vector<std::thread> workers;
+    for(unsigned i = 0; i < threads; ++i){
+        Socket & s = servers[i];
+        Socket & c = clients[i];
+        ClientStats & st = stats[i];
+        if(path == Path::Epoll){
+            workers.emplace_back([&]{ serve_epoll(s, phase); });
+            workers.emplace_back([&, payload]{ client_epoll(c, payload, cfg.window, phase, st); });
+        }
+        else {
+            workers.emplace_back([&]{ serve_batch(s, phase); });
+            workers.emplace_back([&, payload]{ client_batch(c, payload, cfg.window, phase, st); });
+        }
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(cfg.warmup));
+    phase = Measure;
+    auto t0 = Clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(cfg.seconds));
+    phase = Stop;
+    auto t1 = Clock::now();
+    for(auto & w : workers){
+        w.join();
+    }
+
+    std::vector<uint32_t> rtt;
+    res = Result{path, payload, threads, cfg.window, std::chrono::duration<double>(t1 - t0).count(), 0, 0, 0, 0, {}};
+    for(auto & st : stats){
+        res.echoes += st.echoes;
+        res.lost   += st.lost;
+        rtt.insert(rtt.end(), st.rtt.begin(), st.rtt.end());
+    }
+    res.pps  = res.echoes / res.seconds;
+    res.gbps = res.pps * payload * 8 / 1e9;
+    res.latency = {{
+        rtt.empty() ? 0 : *std::min_element(rtt.begin(), rtt.end()),
+        percentile(rtt, 0.50),
+        percentile(rtt, 0.90),
+        percentile(rtt, 0.99),
+        percentile(rtt, 0.999),
+        rtt.empty() ? 0 : *std::max_element(rtt.begin(), rtt.end()),
+    }};
+    return true;
+}
+
+void write_json(std::ostream & os, const std::vector<Result> & results){
+    os << "{\n  \"benchmark\": \"udp_echo_loopback\",\n"
+       << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n"
+       << "  \"results\": [";
+    for(size_t i = 0; i < results.size(); ++i){
+        const auto & r = results[i];
+        os << (i ? "," : "") << "\n    {"
+           << "\"path\": \"" << path_name(r.path) << "\", "
+           << "\"payload\": " << r.payload << ", "
+           << "\"threads\": " << r.threads << ", "
+           << "\"window\": " << r.window << ", "
+           << "\"seconds\": " << r.seconds << ", "
+           << "\"echoes\": " << r.echoes << ", "
+           << "\"lost\": " << r.lost << ", "
+           << "\"pps\": " << static_cast<uint64_t>(r.pps) << ", "
+           << "\"gbps\": " << r.gbps << ", "
+           << "\"latency_ns\": {"
+           << "\"min\": "  << r.latency[0] << ", "
+           << "\"p50\": "  << r.latency[1] << ", "
+           << "\"p90\": "  << r.latency[2] << ", "
+           << "\"p99\": "  << r.latency[3] << ", "
+           << "\"p999\": " << r.latency[4] << ", "
+           << "\"max\": "  << r.latency[5] << "}}";
+    }
+    os << "\n  ]\n}\n";
+}
+
+template <typename T>
+std::vector<T> parse_list(const std::string & s){
+    std::vector<T> v;
+    std::stringstream ss(s);
+    std::string item;
+    while(std::getline(ss, item, ',')){
+        v.push_back(static_cast<T>(std::stoul(item)));
+    }
+    return v;
+}
+
+void usage(const char * argv0){
+    std::cerr << "usage: " << argv0
+              << " [--sizes 64,512,1400] [--threads 1,2,4] [--paths epoll,batch]"
+                 " [--window 32] [--seconds 2] [--warmup 0.25] [--out file.json]\n";
+}
+
+bool parse_args(int argc, char ** argv, Config & cfg){
+    for(int i = 1; i < argc; ++i){
+        std::string a = argv[i];
+        if(i + 1 >= argc){
+            return false;
+        }
+        std::string v = argv[++i];
+        try {
+            if(a == "--sizes"){
+                cfg.sizes = parse_list<size_t>(v);
+            }
+            else if(a == "--threads"){
+                cfg.threads = parse_list<unsigned>(v);
+            }
+            else if(a == "--paths"){
+                cfg.paths.clear();
+                std::stringstream ss(v);
+                std::string p;
+                while(std::getline(ss, p, ',')){
+                    if(p == "epoll")      { cfg.paths.push_back(Path::Epoll); }
+                    else if(p == "batch") { cfg.paths.push_back(Path::Batch); }
+                    else                  { return false; }
+                }
+            }
+            else if(a == "--window") { cfg.window  = std::stoul(v); }
+            else if(a == "--seconds"){ cfg.seconds = std::stod(v); }
+            else if(a == "--warmup") { cfg.warmup  = std::stod(v); }
+            else if(a == "--out")    { cfg.out     = v; }
+            else {
+                return false;
+            }
+        }
+        catch(const std::exception &){
+            return false;
+        }
+    }
+    for(auto s : cfg.sizes){
+        if(s < sizeof(uint64_t) || s > max_payload){
+            std::cerr << "payload sizes must be within [" << sizeof(uint64_t) << ", " << max_payload << "]\n";
+            return false;
+        }
+    }
+    return cfg.window > 0 && cfg.seconds > 0;
+}
+
+} // anon ns
+
+int main(int argc, char ** argv){
+    Config cfg;
+    if(!parse_args(argc, argv, cfg)){
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<Result> results;
+    for(auto path : cfg.paths){
+        for(auto threads : cfg.threads){
+            for(auto size : cfg.sizes){
+                Result r;
+                if(!run(cfg, path, size, threads, r)){
+                    std::cerr << "could not set up sockets: " << unix::errno_str(errno) << "\n";
+                    return 1;
+                }
+                fprintf(stderr, "%-5s payload %5zu threads %2u: %9.0f pps %7.3f Gbit/s  "
+                                "p50 %7.1fus p99 %7.1fus p99.9 %7.1fus  lost %llu\n",
+                        path_name(path), size, threads, r.pps, r.gbps,
+                        r.latency[1] / 1e3, r.latency[3] / 1e3, r.latency[4] / 1e3,
+                        static_cast<unsigned long long>(r.lost));
+                results.push_back(r);
+            }
+        }
+    }
+
+    if(cfg.out.empty()){
+        write_json(std::cout, results);
+    }
+    else {
+        std::ofstream f(cfg.out);
+        write_json(f, results);
+        if(!f){
+            std::cerr << "could not write " << cfg.out << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -1,8 +1,16 @@
 #pragma once
 
 #include <experimental/optional>
+#include <experimental/string_view>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <type_traits>
 #include <vector>
 #include <algorithm>
+#include <ostream>
+#include <string>
 
 namespace cpp {
     template <typename T>
@@ -47,39 +55,287 @@ namespace cpp {
         return to_int(std::begin(l), std::end(l));
     }
 
-    template<typename EnumType, EnumType... Values>
-    class EnumCheck;
-
-    template<typename EnumType>
-    class EnumCheck<EnumType>
-    {
+    // Set of bit flags of the enum class E, stored as a single integer. Everything is
+    // constexpr, so a set known at compile time is a single integer constant:
+    //
+    //   Flags<SendFlag> f = {SendFlag::More, SendFlag::NoSignal};
+    //   f |= SendFlag::DontWait;
+    //   if(f.contains(SendFlag::More)) { ... }
+    //   for(SendFlag x : f) { ... }        // set bits, lowest first
+    //
+    // A brace list converts implicitly, so interfaces taking Flags are called just
+    // like the ones that took a std::initializer_list.
+    template <typename E>
+    class Flags {
+        static_assert(std::is_enum<E>::value, "Flags<E> requires an enum type");
     public:
-        template<typename IntType>
-        static bool constexpr is_value(IntType) { return false; }
+        using value_type = std::underlying_type_t<E>;
+
+        constexpr Flags() noexcept : _v(0) {}
+        constexpr Flags(E e) noexcept : _v(to_underlying(e)) {}
+        constexpr Flags(std::initializer_list<E> l) noexcept : _v(0) {
+            for(auto e : l){
+                _v |= to_underlying(e);
+            }
+        }
+
+        // No validation: bits without an enumerator are kept as they are
+        static constexpr Flags from_value(value_type v) noexcept { Flags f; f._v = v; return f; }
+
+        constexpr value_type value() const noexcept { return _v; }
+        constexpr bool empty() const noexcept { return _v == 0; }
+        constexpr explicit operator bool() const noexcept { return _v != 0; }
+
+        // All bits of 'e' (or 'o') are set
+        constexpr bool contains(E e) const noexcept { return (_v & to_underlying(e)) == to_underlying(e); }
+        constexpr bool contains(Flags o) const noexcept { return (_v & o._v) == o._v; }
+
+        // Number of set bits
+        constexpr int size() const noexcept {
+            int n = 0;
+            for(auto v = _bits(); v; v &= v - 1){
+                ++n;
+            }
+            return n;
+        }
+
+        constexpr Flags & operator|=(Flags o) noexcept { _v |= o._v; return *this; }
+        constexpr Flags & operator&=(Flags o) noexcept { _v &= o._v; return *this; }
+        constexpr Flags & remove(Flags o) noexcept { _v &= ~o._v; return *this; }
+
+        friend constexpr Flags operator|(Flags a, Flags b) noexcept { return from_value(a._v | b._v); }
+        friend constexpr Flags operator&(Flags a, Flags b) noexcept { return from_value(a._v & b._v); }
+        friend constexpr bool operator==(Flags a, Flags b) noexcept { return a._v == b._v; }
+        friend constexpr bool operator!=(Flags a, Flags b) noexcept { return a._v != b._v; }
+
+        // Visits the set bits as E, lowest first
+        class iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type        = E;
+            using difference_type   = std::ptrdiff_t;
+            using pointer           = const E *;
+            using reference         = E;
+
+            constexpr explicit iterator(std::make_unsigned_t<typename Flags::value_type> v) noexcept : _rest(v) {}
+            constexpr E operator*() const noexcept { return static_cast<E>(_rest & (~_rest + 1)); }
+            constexpr iterator & operator++() noexcept { _rest &= _rest - 1; return *this; }
+            constexpr iterator operator++(int) noexcept { auto t = *this; ++*this; return t; }
+            constexpr bool operator==(const iterator & o) const noexcept { return _rest == o._rest; }
+            constexpr bool operator!=(const iterator & o) const noexcept { return _rest != o._rest; }
+        private:
+            std::make_unsigned_t<typename Flags::value_type> _rest;
+        };
+        constexpr iterator begin() const noexcept { return iterator(_bits()); }
+        constexpr iterator end()   const noexcept { return iterator(0); }
+
+    private:
+        constexpr std::make_unsigned_t<value_type> _bits() const noexcept {
+            return static_cast<std::make_unsigned_t<value_type>>(_v);
+        }
+
+        value_type _v;
     };
 
-    template<typename EnumType, EnumType V, EnumType... Next>
-    class EnumCheck<EnumType, V, Next...> : private EnumCheck<EnumType, Next...>
+    // The value as the int the C interfaces take
+    template <typename E>
+    constexpr int to_int(Flags<E> f){
+        return static_cast<int>(f.value());
+    }
+
+    // Enumerator lookups in O(1). The values of an enum are mapped to 64 slots:
+    // directly if all of them are below 64 (e.g. AddressFamily), by bit position if
+    // all of them are single bits (flags). Anything else is found by a linear scan.
+    namespace _enum_index {
+        enum Mode { Direct, Bit, Scan };
+
+        template <typename U>
+        constexpr uint64_t widen(U v){
+            return static_cast<uint64_t>(static_cast<std::make_unsigned_t<U>>(v));
+        }
+        constexpr bool single_bit(uint64_t v){ return v && !(v & (v - 1)); }
+
+        // Whether 'v' is representable in U, i.e. survives static_cast<U> unchanged.
+        // One overload per signedness combination, so that no branch compares
+        // signed with unsigned.
+        template <typename U, typename T>
+        constexpr bool _fits(T v, std::integral_constant<int, 0>){     // same signedness
+            return v >= std::numeric_limits<U>::min() && v <= std::numeric_limits<U>::max();
+        }
+        template <typename U, typename T>
+        constexpr bool _fits(T v, std::integral_constant<int, 1>){     // signed into unsigned
+            return v >= 0 && static_cast<std::make_unsigned_t<T>>(v) <= std::numeric_limits<U>::max();
+        }
+        template <typename U, typename T>
+        constexpr bool _fits(T v, std::integral_constant<int, 2>){     // unsigned into signed
+            return v <= static_cast<std::make_unsigned_t<U>>(std::numeric_limits<U>::max());
+        }
+        template <typename U, typename T>
+        constexpr bool _fits(T, std::integral_constant<int, 3>){       // an enumerator
+            return true;
+        }
+        template <typename U, typename T>
+        constexpr bool fits(T v){
+            using S = std::integral_constant<int, std::is_enum<T>::value ? 3
+                                                : (std::is_signed<T>::value == std::is_signed<U>::value) ? 0
+                                                : std::is_signed<T>::value ? 1 : 2>;
+            return _fits<U>(v, S{});
+        }
+
+        constexpr Mode mode(const uint64_t * v, size_t n){
+            bool direct = true, bits = true;
+            for(size_t i = 0; i < n; ++i){
+                direct = direct && v[i] < 64;
+                bits   = bits && single_bit(v[i]);
+            }
+            return direct ? Direct : (bits ? Bit : Scan);
+        }
+        // Slot of 'v', or -1 if no enumerator can have that value
+        constexpr int slot(Mode m, uint64_t v){
+            return (m == Direct) ? ((v < 64) ? int(v) : -1)
+                 : (m == Bit)    ? (single_bit(v) ? __builtin_ctzll(v) : -1)
+                 : -1;
+        }
+    } // ns _enum_index
+
+    // Checks whether an integer is one of 'Values', against a bitmap of the slots
+    // that is computed at compile time.
+    template<typename EnumType, EnumType... Values>
+    class EnumCheck
     {
-        using super = EnumCheck<EnumType, Next...>;
+        static_assert(sizeof...(Values) > 0, "EnumCheck needs at least one value");
+        using U = std::underlying_type_t<EnumType>;
+
+        static constexpr _enum_index::Mode _mode(){
+            const uint64_t v[] = {_enum_index::widen<U>(to_underlying(Values))...};
+            return _enum_index::mode(v, sizeof...(Values));
+        }
+        static constexpr uint64_t _slots(){
+            const uint64_t v[] = {_enum_index::widen<U>(to_underlying(Values))...};
+            uint64_t m = 0;
+            for(auto x : v){
+                int s = _enum_index::slot(_mode(), x);
+                m |= (s < 0) ? 0 : (uint64_t(1) << s);
+            }
+            return m;
+        }
 
     public:
         template<typename IntType>
-        static bool constexpr is_value(IntType v)
+        static constexpr bool is_value(IntType v)
         {
-            return v == static_cast<IntType>(V) || super::is_value(v);
+            constexpr auto     mode  = _mode();
+            constexpr uint64_t slots = _slots();
+            // Check before narrowing, or a large value could alias a valid one
+            if(!_enum_index::fits<U>(v)){
+                return false;
+            }
+            const uint64_t u = _enum_index::widen<U>(static_cast<U>(v));
+            if(mode != _enum_index::Scan){
+                int s = _enum_index::slot(mode, u);
+                return s >= 0 && ((slots >> s) & 1);
+            }
+            const uint64_t vals[] = {_enum_index::widen<U>(to_underlying(Values))...};
+            for(auto x : vals){
+                if(x == u){
+                    return true;
+                }
+            }
+            return false;
         }
 
         template <typename IntType>
         static Maybe<EnumType> to_enum(IntType v)
         {
-            if(super::is_value(v)){
+            if(is_value(v)){
                 return static_cast<EnumType>(v);
             }
             return Nothing();
         }
     };
 
+    using StringView = std::experimental::string_view;
+
+    template <typename E>
+    struct EnumEntry {
+        constexpr EnumEntry() : value(), name() {}
+        // From a string literal; the length is known without strlen(), which is
+        // not constexpr in C++14
+        template <size_t L>
+        constexpr EnumEntry(E v, const char (&n)[L]) : value(v), name(n, L - 1) {}
+
+        E          value;
+        StringView name;
+    };
+
+    // Names of the enumerators of E, in static storage. Build one with
+    // make_enum_table() as a constexpr object; name() is then an O(1) lookup that
+    // returns a view of a string literal, and iterating visits the entries in the
+    // order given.
+    template <typename E, size_t N>
+    class EnumTable {
+        static_assert(N > 0, "EnumTable needs at least one entry");
+        using U = std::underlying_type_t<E>;
+    public:
+        constexpr EnumTable(const EnumEntry<E> (&entries)[N]) : _entries{}, _mode(_enum_index::Scan), _slots{} {
+            uint64_t v[N] = {};
+            for(size_t i = 0; i < N; ++i){
+                _entries[i] = entries[i];
+                v[i] = _enum_index::widen<U>(to_underlying(entries[i].value));
+            }
+            _mode = _enum_index::mode(v, N);
+            for(size_t i = 0; i < N && _mode != _enum_index::Scan; ++i){
+                _slots[_enum_index::slot(_mode, v[i])] = static_cast<uint8_t>(i + 1);
+            }
+        }
+
+        Maybe<StringView> name(E e) const {
+            const auto * p = _find(_enum_index::widen<U>(to_underlying(e)));
+            if(!p){
+                return Nothing();
+            }
+            return p->name;
+        }
+        bool contains(E e) const { return _find(_enum_index::widen<U>(to_underlying(e))) != nullptr; }
+
+        constexpr size_t size() const { return N; }
+        const EnumEntry<E> * begin() const { return _entries; }
+        const EnumEntry<E> * end()   const { return _entries + N; }
+
+    private:
+        const EnumEntry<E> * _find(uint64_t v) const {
+            if(_mode == _enum_index::Scan){
+                for(const auto & e : _entries){
+                    if(_enum_index::widen<U>(to_underlying(e.value)) == v){
+                        return &e;
+                    }
+                }
+                return nullptr;
+            }
+            int s = _enum_index::slot(_mode, v);
+            return (s >= 0 && _slots[s]) ? &_entries[_slots[s] - 1] : nullptr;
+        }
+
+        EnumEntry<E>      _entries[N];
+        _enum_index::Mode _mode;
+        uint8_t           _slots[64];   // entry index + 1, 0 = none
+    };
+
+    // constexpr auto foo_names = cpp::make_enum_table<Foo>({{Foo::A, "Foo::A"}, ...});
+    template <typename E, size_t N>
+    constexpr EnumTable<E, N> make_enum_table(const EnumEntry<E> (&entries)[N]){
+        return EnumTable<E, N>(entries);
+    }
+
+    // For to_string(): the name, or "<Unknown Type: 123>"
+    template <typename E>
+    inline std::string enum_to_string(const Maybe<StringView> & name, const char * type, E v){
+        if(name){
+            return std::string(name->data(), name->size());
+        }
+        return std::string("<Unknown ") + type + ": " + std::to_string(to_underlying(v)) + ">";
+    }
+
     template <class Checker, typename T>
     inline cpp::Maybe<typename std::underlying_type<T>::type> _to_integral(T f){
         if(Checker::is_value(f)){ return cpp::to_underlying(f); } else { return cpp::Nothing(); }
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+
+namespace _unix {
+
+class BufferPool;
+
+// Reference counted handle to one slot of a BufferPool. Copying the handle shares the
+// slot (no payload copy), so a received packet can be queued for a later send while
+// the receive path moves on. The slot goes back to the pool when the last handle is
+// gone.
+//
+// A default constructed handle is empty; so is the one returned by an exhausted pool.
+class PoolBuffer {
+public:
+    PoolBuffer() : _pool(nullptr), _index(0) {}
+    ~PoolBuffer() { reset(); }
+
+    PoolBuffer(const PoolBuffer & o);
+    PoolBuffer & operator=(const PoolBuffer & o);
+    PoolBuffer(PoolBuffer && o) : _pool(o._pool), _index(o._index) { o._pool = nullptr; }
+    PoolBuffer & operator=(PoolBuffer && o);
+
+    explicit operator bool() const { return _pool != nullptr; }
+
+    uint8_t * data() const;
+    size_t    capacity() const;
+
+    // Number of valid bytes, e.g. as set by Socket::recv()
+    size_t size() const;
+    void   set_size(size_t n);
+
+    // Handles sharing this slot, including this one
+    uint32_t use_count() const;
+
+    void reset();
+
+private:
+    friend class BufferPool;
+    PoolBuffer(BufferPool * p, uint32_t i) : _pool(p), _index(i) {}
+
+    BufferPool * _pool;
+    uint32_t     _index;
+};
+
+// Fixed number of fixed size packet buffers carved out of a single memory region.
+// The region is backed by huge pages if the system has them reserved
+// (vm.nr_hugepages), otherwise transparent huge pages are requested. Slots are
+// rounded up to whole cache lines, and each has one more line of metadata.
+//
+// acquire() and release are O(1): a free list of slot indices under a mutex. Threads
+// that allocate a lot should put a BufferPool::Cache on their stack; it keeps a
+// small private free list and only touches the shared one in batches.
+class BufferPool {
+public:
+    static constexpr size_t cache_line = 64;
+
+    // Throws std::runtime_error if the region cannot be allocated
+    BufferPool(size_t slot_size, uint32_t count);
+    ~BufferPool();
+
+    // RO3. Handles point to the pool, so it cannot move either.
+    BufferPool(const BufferPool &)            = delete;
+    BufferPool& operator=(const BufferPool &) = delete;
+
+    // Empty handle if all slots are in use
+    PoolBuffer acquire();
+
+    size_t   slot_size() const { return _slot_size; }
+    uint32_t count()     const { return _count; }
+    bool     hugepages() const { return _huge; }
+
+    // Slots in the shared free list (not counting per-thread caches)
+    size_t available();
+
+    // Per-thread front end. While alive, acquire() and releases on this thread go
+    // through it. Caches of several pools may be active in one thread.
+    class Cache {
+    public:
+        Cache(BufferPool & pool, uint32_t batch = 32);
+        ~Cache();
+
+        Cache(const Cache &)            = delete;
+        Cache& operator=(const Cache &) = delete;
+    private:
+        friend class BufferPool;
+        BufferPool &          _pool;
+        uint32_t              _batch;
+        std::vector<uint32_t> _free;
+        Cache *               _next;    // other caches active in this thread
+    };
+
+private:
+    friend class PoolBuffer;
+
+    // One cache line each: handles of neighbouring slots are usually used by
+    // different threads, and the refcount of one must not bounce the other's line.
+    // Kept in the region after the slots, where the alignment is guaranteed.
+    struct alignas(cache_line) Meta {
+        std::atomic<uint32_t> refs;
+        uint32_t              size;
+    };
+
+    uint8_t * _slot(uint32_t i) const { return _base + size_t(i) * _slot_size; }
+    void _release(uint32_t i);
+    Cache * _local_cache();
+
+    size_t                _slot_size;
+    uint32_t              _count;
+    size_t                _bytes;
+    bool                  _huge;
+    uint8_t *             _base;
+    Meta *                _meta;
+
+    std::mutex            _lock;
+    std::vector<uint32_t> _free;
+};
+
+inline uint8_t * PoolBuffer::data()     const { return _pool ? _pool->_slot(_index) : nullptr; }
+inline size_t    PoolBuffer::capacity() const { return _pool ? _pool->_slot_size : 0; }
+inline size_t    PoolBuffer::size()     const { return _pool ? _pool->_meta[_index].size : 0; }
+inline void      PoolBuffer::set_size(size_t n) {
+    assert(_pool && n <= capacity());
+    _pool->_meta[_index].size = n;
+}
+inline uint32_t  PoolBuffer::use_count() const {
+    return _pool ? _pool->_meta[_index].refs.load(std::memory_order_relaxed) : 0;
+}
+
+inline PoolBuffer::PoolBuffer(const PoolBuffer & o) : _pool(o._pool), _index(o._index) {
+    if(_pool){
+        _pool->_meta[_index].refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+inline PoolBuffer & PoolBuffer::operator=(const PoolBuffer & o){
+    if(this != &o){
+        PoolBuffer tmp(o);
+        *this = std::move(tmp);
+    }
+    return *this;
+}
+inline PoolBuffer & PoolBuffer::operator=(PoolBuffer && o){
+    if(this != &o){
+        reset();
+        _pool  = o._pool;
+        _index = o._index;
+        o._pool = nullptr;
+    }
+    return *this;
+}
+inline void PoolBuffer::reset(){
+    if(_pool){
+        if(_pool->_meta[_index].refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+            _pool->_release(_index);
+        }
+        _pool = nullptr;
+    }
+}
+
+} // ns _unix
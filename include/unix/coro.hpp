@@ -0,0 +1,474 @@
+#pragma once
+
+// C++20 coroutines on top of EventLoop. Optional: this header needs a compiler with
+// coroutine support (-std=c++20, CMake option UNIXBURRITO_COROUTINES); the rest of
+// the library stays C++14.
+//
+//   coro::Task<void> echo(coro::Reactor & r, coro::AsyncSocket s){
+//       uint8_t buf[2048];
+//       while(true){
+//           auto p = co_await s.async_recvfrom(buf, sizeof(buf));
+//           if(p.first < 0 || !p.second){
+//               break;
+//           }
+//           co_await s.async_sendto(buf, p.first, *p.second);
+//       }
+//   }
+//   ...
+//   coro::Reactor r;
+//   coro::spawn(echo(r, coro::AsyncSocket(r, std::move(*sock))));
+//   r.run();
+//
+// Operations first try the non-blocking syscall and only suspend on EAGAIN. The
+// waiting coroutine is resumed straight from the epoll dispatch once the syscall
+// completes, so there is no queue and no allocation per operation: the awaiter
+// lives in the coroutine frame, and the frames themselves come from a per-thread
+// pool (FramePool). Everything runs in the Reactor's thread.
+
+#if !defined(__cpp_impl_coroutine)
+#error "unix/coro.hpp requires C++20 coroutines (e.g. -std=c++20)"
+#endif
+
+#include <sys/socket.h>
+
+#include <array>
+#include <cerrno>
+#include <coroutine>
+#include <exception>
+#include <new>
+#include <optional>
+#include <utility>
+
+#include <cpp.hpp>
+#include <unix/inet.hpp>
+#include <unix/epoll.hpp>
+#include <unix/timer.hpp>
+
+namespace _unix {
+
+namespace coro {
+
+// Recycles coroutine frames. Sizes are rounded up to 64 bytes; each size class up
+// to max_pooled has a free list. Per thread, so no locking: a frame freed in
+// another thread simply joins that thread's lists. Larger frames go to the heap.
+class FramePool {
+public:
+    static constexpr size_t granule    = 64;
+    static constexpr size_t max_pooled = 4096;
+    static constexpr size_t classes    = max_pooled / granule;
+
+    static FramePool & local(){
+        static thread_local FramePool p;
+        return p;
+    }
+
+    ~FramePool(){
+        for(auto * head : _free){
+            while(head){
+                auto * next = head->next;
+                ::operator delete(head);
+                head = next;
+            }
+        }
+    }
+
+    void * allocate(size_t n){
+        if(n > max_pooled){
+            return ::operator new(n);
+        }
+        auto & head = _free[_class(n)];
+        if(head){
+            auto * b = head;
+            head = b->next;
+            return b;
+        }
+        return ::operator new(_rounded(n));
+    }
+    void deallocate(void * p, size_t n){
+        if(n > max_pooled){
+            ::operator delete(p);
+            return;
+        }
+        auto * b = static_cast<Block*>(p);
+        auto & head = _free[_class(n)];
+        b->next = head;
+        head = b;
+    }
+
+private:
+    struct Block { Block * next; };
+
+    static size_t _class(size_t n)   { return (n + granule - 1) / granule - 1; }
+    static size_t _rounded(size_t n) { return (_class(n) + 1) * granule; }
+
+    std::array<Block*, classes> _free{};
+};
+
+template <typename T = void>
+class Task;
+
+namespace detail {
+
+// Frames of every Task come from FramePool
+struct PooledPromise {
+    static void * operator new(size_t n){ return FramePool::local().allocate(n); }
+    static void operator delete(void * p, size_t n){ FramePool::local().deallocate(p, n); }
+};
+
+struct PromiseBase : PooledPromise {
+    std::coroutine_handle<> continuation;   // who awaits this task
+    std::exception_ptr      error;
+    bool                    detached = false;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    // Hand control back to the awaiting coroutine, or clean up after spawn()
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            auto & p = h.promise();
+            if(p.continuation){
+                return p.continuation;
+            }
+            if(p.detached){
+                if(p.error){
+                    std::terminate();   // nobody to rethrow to, as with std::thread
+                }
+                h.destroy();
+            }
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() noexcept { error = std::current_exception(); }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object() noexcept;
+    template <typename U>
+    void return_value(U && v){ value.emplace(std::forward<U>(v)); }
+
+    T result(){
+        if(error){
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object() noexcept;
+    void return_void() noexcept {}
+
+    void result(){
+        if(error){
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+} // ns detail
+
+// A coroutine returning T. Lazy: it starts when awaited (or spawn()ed), and the
+// awaiting coroutine continues when it finishes. Exceptions propagate to the
+// awaiter.
+template <typename T>
+class [[nodiscard]] Task {
+public:
+    using promise_type = detail::Promise<T>;
+    using Handle       = std::coroutine_handle<promise_type>;
+
+    explicit Task(Handle h) : _h(h) {}
+    ~Task(){
+        if(_h){
+            _h.destroy();
+        }
+    }
+
+    // RO3
+    Task(const Task &)            = delete;
+    Task& operator=(const Task &) = delete;
+    Task(Task && o) noexcept : _h(std::exchange(o._h, nullptr)) {}
+    Task& operator=(Task && o) noexcept { std::swap(_h, o._h); return *this; }
+
+    bool await_ready() const noexcept { return !_h || _h.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        _h.promise().continuation = awaiting;
+        return _h;
+    }
+    T await_resume(){ return _h.promise().result(); }
+
+    // Used by spawn()
+    Handle _release(){ return std::exchange(_h, nullptr); }
+
+private:
+    Handle _h;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> Promise<T>::get_return_object() noexcept {
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+inline Task<void> Promise<void>::get_return_object() noexcept {
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+} // ns detail
+
+// Start 't' now, without anyone waiting for it. The frame is freed when it
+// finishes. An exception escaping it calls std::terminate().
+inline void spawn(Task<void> && t){
+    auto h = t._release();
+    if(h){
+        h.promise().detached = true;
+        h.resume();
+    }
+}
+
+// EventLoop plus a TimerWheel for sleep_for(). Not thread safe, like both of them.
+class Reactor {
+public:
+    using Loop = _unix::epoll::EventLoop<256>;
+
+    // Throws std::runtime_error if the epoll instance or the timerfd cannot be created
+    explicit Reactor(NanoSeconds tick = std::chrono::milliseconds(1)) : _timers(tick) {
+        _loop.add(_timers.__fd(), _timers, {_unix::epoll::EpollEventType::Input});
+    }
+    ~Reactor(){
+        _loop.remove(_timers.__fd(), _timers);
+    }
+
+    // RO3
+    Reactor(const Reactor &)            = delete;
+    Reactor& operator=(const Reactor &) = delete;
+
+    // Dispatch until stop()
+    int run()  { return _loop.run(); }
+    void stop(){ _loop.stop(); }
+
+    Loop &       loop()   { return _loop; }
+    TimerWheel & timers() { return _timers; }
+
+    // co_await r.sleep_for(d): resume after at least 'd' (rounded up to the tick)
+    class SleepAwaiter {
+    public:
+        SleepAwaiter(TimerWheel & w, NanoSeconds d) : _wheel(w), _delay(d) {}
+        bool await_ready() const noexcept { return _delay.count() <= 0; }
+        void await_suspend(std::coroutine_handle<> h){
+            // The lambda fits in std::function's small buffer: no allocation
+            _wheel.schedule(_timer, _delay, [h](Timer &){ h.resume(); });
+        }
+        void await_resume() noexcept {}
+    private:
+        TimerWheel & _wheel;
+        NanoSeconds  _delay;
+        Timer        _timer;
+    };
+    SleepAwaiter sleep_for(NanoSeconds d){ return SleepAwaiter(_timers, d); }
+
+private:
+    Loop       _loop;
+    TimerWheel _timers;
+};
+
+class AsyncSocket;
+
+namespace detail {
+
+// An operation waiting for readiness. attempt() retries the syscall and returns
+// false while it would still block.
+struct PendingOp {
+    virtual bool attempt() = 0;
+    std::coroutine_handle<> waiter;
+protected:
+    ~PendingOp() = default;
+};
+
+inline bool would_block(ssize_t ret){
+    return ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+} // ns detail
+
+// Socket registered with a Reactor, with awaitable operations. The socket is made
+// non-blocking and registered edge triggered for input and output, once; after
+// that waiting costs nothing but the epoll event itself.
+//
+// At most one read-side (recv, recvfrom, accept) and one write-side (send, sendto,
+// connect) operation may be pending at a time. The AsyncSocket must not be destroyed
+// or moved while an operation is pending.
+class AsyncSocket : public _unix::epoll::EventHandler {
+public:
+    using Socket   = _unix::inet::Socket;
+    using SockAddr = _unix::inet::SockAddr;
+
+    // Throws std::runtime_error if the socket cannot be registered
+    AsyncSocket(Reactor & r, Socket && s) : _r(&r), _s(std::move(s)) {
+        _s.setblocking(false);
+        _register();
+    }
+    ~AsyncSocket(){
+        if(_r && _s.__fd() >= 0){
+            _r->loop().remove(_s, *this);
+        }
+    }
+
+    // RO3. Moving re-registers, since epoll holds the address of the object.
+    AsyncSocket(const AsyncSocket &)            = delete;
+    AsyncSocket& operator=(const AsyncSocket &) = delete;
+    AsyncSocket(AsyncSocket && o) : _r(o._r), _s(std::move(o._s)) {
+        if(_r){
+            _r->loop().remove(_s, o);
+            _register();
+        }
+        o._r = nullptr;
+    }
+
+    // Same results as the Socket functions of the same name
+    auto async_recv(uint8_t * buf, size_t len, cpp::Flags<_unix::inet::RecvFlag> fl = {}){
+        return _op<ssize_t>(_reader, [=, this]{ return _s.recv(buf, len, fl | _unix::inet::RecvFlag::DontWait); });
+    }
+    auto async_recvfrom(uint8_t * buf, size_t len, cpp::Flags<_unix::inet::RecvFlag> fl = {}){
+        using R = std::pair<ssize_t, cpp::Maybe<SockAddr>>;
+        return _op<R>(_reader, [=, this]{ return _s.recvfrom(buf, len, fl | _unix::inet::RecvFlag::DontWait); });
+    }
+    auto async_send(const uint8_t * buf, size_t len, cpp::Flags<_unix::inet::SendFlag> fl = {}){
+        return _op<ssize_t>(_writer, [=, this]{ return _s.send(buf, len, fl | _unix::inet::SendFlag::DontWait); });
+    }
+    auto async_sendto(const uint8_t * buf, size_t len, const SockAddr & dest, cpp::Flags<_unix::inet::SendFlag> fl = {}){
+        return _op<ssize_t>(_writer, [=, this, &dest]{ return _s.sendto(buf, len, dest, fl | _unix::inet::SendFlag::DontWait); });
+    }
+
+    // Accepted sockets are non-blocking; wrap them in an AsyncSocket of their own.
+    // (No brace list default: GCC 12 miscompiles those in coroutine bodies.)
+    auto async_accept(cpp::Flags<_unix::inet::SocketFlag> fl =
+            cpp::Flags<_unix::inet::SocketFlag>(_unix::inet::SocketFlag::NonBlock) | _unix::inet::SocketFlag::CloseOnExec){
+        using R = cpp::Maybe<_unix::inet::Connection>;
+        return _op<R>(_reader, [=, this]{ return _s.accept(fl | _unix::inet::SocketFlag::NonBlock); });
+    }
+
+    // 0, or -1 and errno
+    auto async_connect(const SockAddr & addr){
+        return ConnectAwaiter(*this, addr);
+    }
+
+    Socket &       socket()       { return _s; }
+    const Socket & socket() const { return _s; }
+
+    void on_event(const _unix::epoll::EpollEvent & ev) override {
+        using _unix::epoll::EpollEventType;
+        const bool fail = (ev & EpollEventType::Error) || (ev & EpollEventType::Hangup);
+
+        // Collect first: resuming may destroy this object
+        std::coroutine_handle<> r, w;
+        if(_reader && (fail || (ev & EpollEventType::Input)) && _reader->attempt()){
+            r = std::exchange(_reader, nullptr)->waiter;
+        }
+        if(_writer && (fail || (ev & EpollEventType::Output)) && _writer->attempt()){
+            w = std::exchange(_writer, nullptr)->waiter;
+        }
+        if(r){ r.resume(); }
+        if(w){ w.resume(); }
+    }
+
+private:
+    // The syscall is tried in await_ready(); only EAGAIN suspends
+    template <typename R, typename F>
+    class IoAwaiter : detail::PendingOp {
+    public:
+        IoAwaiter(detail::PendingOp *& slot, F f) : _slot(slot), _f(std::move(f)) {}
+
+        bool await_ready(){ return attempt(); }
+        void await_suspend(std::coroutine_handle<> h){
+            waiter = h;
+            _slot  = this;
+        }
+        R await_resume(){ return std::move(*_result); }
+
+        bool attempt() override {
+            auto r = _f();
+            if(_blocked(r)){
+                return false;
+            }
+            _result.emplace(std::move(r));
+            return true;
+        }
+    private:
+        static bool _blocked(ssize_t r) { return detail::would_block(r); }
+        static bool _blocked(const std::pair<ssize_t, cpp::Maybe<SockAddr>> & r) { return detail::would_block(r.first); }
+        static bool _blocked(const cpp::Maybe<_unix::inet::Connection> & r) { return !r && detail::would_block(-1); }
+
+        detail::PendingOp *& _slot;
+        F                    _f;
+        std::optional<R>     _result;
+    };
+
+    template <typename R, typename F>
+    IoAwaiter<R, F> _op(detail::PendingOp *& slot, F f){ return IoAwaiter<R, F>(slot, std::move(f)); }
+
+    // connect() returns EINPROGRESS, then the socket becomes writable and SO_ERROR
+    // holds the outcome
+    class ConnectAwaiter : detail::PendingOp {
+    public:
+        ConnectAwaiter(AsyncSocket & s, const SockAddr & a) : _s(s), _addr(a) {}
+
+        bool await_ready(){
+            if(_s._s.connect(_addr) == 0){
+                return true;
+            }
+            _error = errno;
+            return _error != EINPROGRESS;
+        }
+        void await_suspend(std::coroutine_handle<> h){
+            waiter = h;
+            _s._writer = this;
+        }
+        int await_resume(){
+            if(_error){
+                errno = _error;
+                return -1;
+            }
+            return 0;
+        }
+
+        bool attempt() override {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if(::getsockopt(_s._s.__fd(), SOL_SOCKET, SO_ERROR, &err, &len) != 0){
+                err = errno;
+            }
+            if(err == EINPROGRESS || err == EALREADY){
+                return false;
+            }
+            _error = err;
+            return true;
+        }
+    private:
+        AsyncSocket &    _s;
+        const SockAddr & _addr;
+        int              _error = 0;
+    };
+
+    void _register(){
+        using _unix::epoll::EpollEventType;
+        _r->loop().add(_s, *this, {EpollEventType::Input, EpollEventType::Output, EpollEventType::EdgeTrigger});
+    }
+
+    Reactor *           _r;
+    Socket              _s;
+    detail::PendingOp * _reader = nullptr;
+    detail::PendingOp * _writer = nullptr;
+};
+
+} // ns coro
+
+} // ns _unix
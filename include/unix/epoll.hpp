@@ -1,17 +1,45 @@
 #pragma once
 
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
 #include <unistd.h>
+#include <time.h>
 #include <chrono>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include <cpp.hpp>
 #include <unix/common.hpp>
 #include <unix/inet.hpp>
+#include <unix/signals.hpp>
+#include <unix/eventfd.hpp>
+#include <unix/log.hpp>
 
 namespace _unix {
 
 namespace epoll {
 
+namespace detail {
+// Per-epoll busy poll parameters: struct epoll_params and the EPIOC[SG]PARAMS ioctls
+// of linux/eventpoll.h (Linux >= 6.9), under names of our own so that they do not
+// clash with newer system headers. The kernel answers ENOTTY if it does not know
+// the ioctl.
+struct EpollParams {
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t  prefer_busy_poll;
+    uint8_t  pad;
+};
+static_assert(sizeof(EpollParams) == 8, "must match struct epoll_params");
+constexpr unsigned long ioc_set_params = _IOW(0x8A, 0x01, EpollParams);
+constexpr unsigned long ioc_get_params = _IOR(0x8A, 0x02, EpollParams);
+} // ns detail
+
 enum class EpollCtrlOperation {
     Add     = EPOLL_CTL_ADD,
     Delete  = EPOLL_CTL_DEL,
@@ -56,6 +84,66 @@ inline bool operator&(EpollEventType et, const EpollEvent & ev){
 template <size_t N>
 using EventList = std::array<EpollEvent, N>;
 
+// Event buffer whose size follows the load. A wait that fills the whole buffer
+// suggests more events were ready, so the buffer doubles (up to 'max'). After a
+// run of waits using less than a quarter of it, it halves again (down to 'min').
+// Resizing happens before the next wait, never while events are being handled.
+class AdaptiveEventList {
+public:
+    static constexpr unsigned shrink_after = 8;     // consecutive low waits
+
+    AdaptiveEventList(size_t min = 16, size_t max = 1024)
+    : _min(min ? min : 1), _max(max < _min ? _min : max), _size(_min), _ready(0), _low(0)
+    {
+        _ev.resize(_size);
+    }
+
+    EpollEvent & operator[](size_t i) { return _ev[i]; }
+    const EpollEvent & operator[](size_t i) const { return _ev[i]; }
+
+    // Current capacity
+    size_t size() const { return _size; }
+    // Events returned by the last wait
+    int ready() const { return _ready; }
+
+private:
+    friend class Epoll;
+
+    EpollEvent * _prepare(){
+        if(_ev.size() != _size){
+            _ev.resize(_size);
+            _ev.shrink_to_fit();
+        }
+        return _ev.data();
+    }
+    void _complete(int n){
+        _ready = (n > 0) ? n : 0;
+        if(n < 0){
+            return;
+        }
+        if(size_t(n) == _size){
+            _size = std::min(_size * 2, _max);
+            _low  = 0;
+        }
+        else if(size_t(n) < _size / 4){
+            if(++_low >= shrink_after){
+                _size = std::max(_size / 2, _min);
+                _low  = 0;
+            }
+        }
+        else {
+            _low = 0;
+        }
+    }
+
+    std::vector<EpollEvent> _ev;
+    size_t   _min;
+    size_t   _max;
+    size_t   _size;
+    int      _ready;
+    unsigned _low;
+};
+
 class EpollUserData {
     // I guess this is useful for setting the data in epoll.. but there is no
     // way to know which union value is set in epoll_event...
@@ -103,21 +191,29 @@ private:
     } u;
 };
 
+// Busy polling of an epoll instance: epoll_wait() spins on the device queues of
+// the (busy poll capable) sockets registered in it for up to 'usecs'.
+struct BusyPollParams {
+    std::chrono::microseconds usecs{0};     // 0 disables
+    uint16_t                  budget = 0;   // packets per round, 0 = kernel default
+    bool                      prefer = false;
+};
+
 class Epoll {
 public:
-    Epoll(const std::initializer_list<EpollFlag> & fl = {})
+    Epoll(cpp::Flags<EpollFlag> fl = {})
     : _efd(epoll_create1(cpp::to_int(fl)))
     {
         if(_efd < 0){
             auto m = _unix::errno_str(errno);
             throw std::runtime_error("epoll_create1(): " + m);
         }
-        std::cerr << "DEBUG: epoll created: " << std::to_string(_efd) << std::endl;
+        UB_DEBUG("epoll created: " << _efd);
     }
 
     ~Epoll(){
         if(_efd > 0){
-            std::cerr << "DEBUG: epoll closing (" << std::to_string(_efd) << ")";
+            UB_DEBUG("epoll closing (" << _efd << ")");
             ::close(_efd);
             _efd = -1;
         }
@@ -130,14 +226,17 @@ public:
     Epoll& operator=(Epoll && o) { _efd = o._efd; o._efd = -1; return *this;}
 
     // --------------------------------------
-    int    add(const _unix::inet::Socket & s, const std::initializer_list<EpollEventType> & l, const Maybe<EpollUserData> & d = Nothing()){ return add(s.__fd(), l, d); }
-    int modify(const _unix::inet::Socket & s, const std::initializer_list<EpollEventType> & l, const Maybe<EpollUserData> & d = Nothing()){ return modify(s.__fd(), l, d); }
+    int    add(const _unix::inet::Socket & s, cpp::Flags<EpollEventType> l, const Maybe<EpollUserData> & d = Nothing()){ return add(s.__fd(), l, d); }
+    int modify(const _unix::inet::Socket & s, cpp::Flags<EpollEventType> l, const Maybe<EpollUserData> & d = Nothing()){ return modify(s.__fd(), l, d); }
     int remove(const _unix::inet::Socket & s){ return remove(s.__fd()); }
 
-    int add(int fd, const std::initializer_list<EpollEventType> & l = {}, const Maybe<EpollUserData> & d = Nothing()){
+    int    add(const _unix::signals::SignalFd & s, cpp::Flags<EpollEventType> l, const Maybe<EpollUserData> & d = Nothing()){ return add(s.__fd(), l, d); }
+    int remove(const _unix::signals::SignalFd & s){ return remove(s.__fd()); }
+
+    int add(int fd, cpp::Flags<EpollEventType> l = {}, const Maybe<EpollUserData> & d = Nothing()){
         return ctl(fd, EpollCtrlOperation::Add, l, d);
     }
-    int modify(int fd, const std::initializer_list<EpollEventType> & l = {}, const Maybe<EpollUserData> & d = Nothing()){
+    int modify(int fd, cpp::Flags<EpollEventType> l = {}, const Maybe<EpollUserData> & d = Nothing()){
         return ctl(fd, EpollCtrlOperation::Modify, l, d);
     }
     // would call this 'delete', but it is a reserved word...
@@ -147,6 +246,7 @@ public:
     }
 
     using MilliSeconds = std::chrono::milliseconds;
+    using NanoSeconds  = std::chrono::nanoseconds;
 
     template <size_t N>
     int wait(EventList<N> & evl, const MilliSeconds & timeout){
@@ -158,8 +258,128 @@ public:
         return ::epoll_wait(_efd, evl.data(), evl.size(), -1);
     }
 
+    // Nanosecond timeout with epoll_pwait2() (Linux >= 5.11). On older kernels, or
+    // where seccomp blocks it, the timeout is rounded up to whole milliseconds for
+    // epoll_pwait().
+    // With 'mask', the signal mask is replaced by it for the duration of the wait,
+    // atomically: signals blocked otherwise can interrupt the wait (EINTR) without
+    // the race of unblocking them just before it.
+    template <size_t N>
+    int wait(EventList<N> & evl, const NanoSeconds & timeout, const _unix::signals::SigSet * mask = nullptr){
+        return _pwait2(evl.data(), evl.size(), &timeout, mask);
+    }
+    template <size_t N>
+    int wait_blocking(EventList<N> & evl, const _unix::signals::SigSet & mask){
+        return _pwait2(evl.data(), evl.size(), nullptr, &mask);
+    }
+
+    int wait(AdaptiveEventList & evl, const MilliSeconds & timeout){
+        auto * p = evl._prepare();
+        int n = ::epoll_wait(_efd, p, evl.size(), timeout.count());
+        evl._complete(n);
+        return n;
+    }
+    int wait(AdaptiveEventList & evl, const NanoSeconds & timeout, const _unix::signals::SigSet * mask = nullptr){
+        auto * p = evl._prepare();
+        int n = _pwait2(p, evl.size(), &timeout, mask);
+        evl._complete(n);
+        return n;
+    }
+    int wait_blocking(AdaptiveEventList & evl, const _unix::signals::SigSet * mask = nullptr){
+        auto * p = evl._prepare();
+        int n = _pwait2(p, evl.size(), nullptr, mask);
+        evl._complete(n);
+        return n;
+    }
+
+    // Wait, but first spin with zero-timeout waits for up to 'spin'. Burns a core
+    // while spinning; shaves the wakeup latency off events arriving meanwhile.
+    // 'timeout' (nullptr = none) applies to the blocking wait afterwards.
+    template <size_t N>
+    int wait_spin(EventList<N> & evl, const NanoSeconds & spin, const NanoSeconds * timeout = nullptr,
+                  const _unix::signals::SigSet * mask = nullptr){
+        int n = _spin(evl.data(), evl.size(), spin);
+        return (n != 0) ? n : _pwait2(evl.data(), evl.size(), timeout, mask);
+    }
+    int wait_spin(AdaptiveEventList & evl, const NanoSeconds & spin, const NanoSeconds * timeout = nullptr,
+                  const _unix::signals::SigSet * mask = nullptr){
+        auto * p = evl._prepare();
+        // Empty spins are not counted as low-load waits
+        int n = _spin(p, evl.size(), spin);
+        if(n == 0){
+            n = _pwait2(p, evl.size(), timeout, mask);
+        }
+        evl._complete(n);
+        return n;
+    }
+
+    // EPIOCSPARAMS (Linux >= 6.9). Returns 0, or -1 and errno (ENOTTY on older
+    // kernels; EPERM when raising the budget without CAP_NET_ADMIN).
+    int set_busy_poll(const BusyPollParams & p){
+        detail::EpollParams ep = {};
+        ep.busy_poll_usecs  = static_cast<uint32_t>(p.usecs.count());
+        ep.busy_poll_budget = p.budget;
+        ep.prefer_busy_poll = p.prefer ? 1 : 0;
+        return ::ioctl(_efd, detail::ioc_set_params, &ep);
+    }
+    Maybe<BusyPollParams> busy_poll() const {
+        detail::EpollParams ep = {};
+        if(::ioctl(_efd, detail::ioc_get_params, &ep) != 0){
+            return Nothing();
+        }
+        BusyPollParams p;
+        p.usecs  = std::chrono::microseconds(ep.busy_poll_usecs);
+        p.budget = ep.busy_poll_budget;
+        p.prefer = ep.prefer_busy_poll != 0;
+        return p;
+    }
+
 private:
-    int ctl(int fd, EpollCtrlOperation op, const std::initializer_list<EpollEventType> & l, const Maybe<EpollUserData> & data){
+    int _spin(EpollEvent * ev, int n, const NanoSeconds & spin){
+        if(spin.count() <= 0){
+            return 0;
+        }
+        const auto until = std::chrono::steady_clock::now() + spin;
+        do {
+            int ret = ::epoll_wait(_efd, ev, n, 0);
+            if(ret != 0){
+                return ret;
+            }
+        } while(std::chrono::steady_clock::now() < until);
+        return 0;
+    }
+
+    // 'timeout' == nullptr blocks
+    int _pwait2(EpollEvent * ev, int n, const NanoSeconds * timeout, const _unix::signals::SigSet * mask){
+        const sigset_t * sm = mask ? mask->get() : nullptr;
+#ifdef SYS_epoll_pwait2
+        static std::atomic<bool> supported(true);
+        if(supported.load(std::memory_order_relaxed)){
+            struct timespec ts;
+            if(timeout){
+                auto ns = std::max(timeout->count(), NanoSeconds::rep(0));
+                ts.tv_sec  = ns / 1000000000;
+                ts.tv_nsec = ns % 1000000000;
+            }
+            int ret = ::syscall(SYS_epoll_pwait2, _efd, ev, n, timeout ? &ts : nullptr, sm, _NSIG / 8);
+            // epoll_pwait2() itself never fails with EPERM, but seccomp filters
+            // older than the syscall (container defaults) answer that instead of ENOSYS
+            if(ret >= 0 || (errno != ENOSYS && errno != EPERM)){
+                return ret;
+            }
+            supported = false;
+        }
+#endif
+        int ms = -1;
+        if(timeout){
+            // Round up, so that a short timeout does not turn into a busy loop
+            auto c = std::max(timeout->count(), NanoSeconds::rep(0));
+            ms = static_cast<int>(std::min<NanoSeconds::rep>((c + 999999) / 1000000, INT32_MAX));
+        }
+        return ::epoll_pwait(_efd, ev, n, ms, sm);
+    }
+
+    int ctl(int fd, EpollCtrlOperation op, cpp::Flags<EpollEventType> l, const Maybe<EpollUserData> & data){
         struct epoll_event ev = {};
         ev.events = cpp::to_int(l);
         if(data){
@@ -175,6 +395,296 @@ private:
     int _efd;
 };
 
+// Receives events dispatched by EventLoop
+class EventHandler {
+public:
+    virtual ~EventHandler() {}
+    virtual void on_event(const EpollEvent & ev) = 0;
+};
+
+// Reads every pending signal off a SignalFd and hands them to on_signal() one by one.
+// Register with EventLoop::add(SignalHandler &).
+class SignalHandler : public EventHandler {
+public:
+    explicit SignalHandler(_unix::signals::SignalFd & sfd) : _sfd(sfd) {}
+
+    virtual void on_signal(const _unix::signals::SignalInfo & si) = 0;
+
+    void on_event(const EpollEvent &) override {
+        // A blocking SignalFd is read only once per event
+        while(auto si = _sfd.read()){
+            on_signal(*si);
+            if(!_sfd.nonblocking()){
+                break;
+            }
+        }
+    }
+
+    _unix::signals::SignalFd & signalfd() { return _sfd; }
+private:
+    _unix::signals::SignalFd & _sfd;
+};
+
+// Lets other threads run code in the thread of an EventLoop. Register with
+// EventLoop::add(TaskQueue &).
+//
+// post() pushes onto a lock-free stack and writes the eventfd only if the stack was
+// empty, so a burst of posts costs a single wakeup. The loop thread then takes the
+// whole stack at once and runs the tasks in posting order. Tasks must not throw.
+class TaskQueue : public EventHandler {
+public:
+    using Task = std::function<void()>;
+
+    // Throws std::runtime_error if the eventfd cannot be created
+    TaskQueue() : _head(nullptr) {}
+
+    // Tasks still queued are dropped without running
+    ~TaskQueue(){
+        Node * n = _head.exchange(nullptr);
+        while(n){
+            Node * next = n->next;
+            delete n;
+            n = next;
+        }
+    }
+
+    // RO3
+    TaskQueue(const TaskQueue &)            = delete;
+    TaskQueue& operator=(const TaskQueue &) = delete;
+
+    // Safe from any thread. Returns 0, or -1 and errno if the wakeup could not be
+    // sent (the task is queued regardless).
+    int post(Task t){
+        Node * n = new Node{std::move(t), nullptr};
+        // Once the CAS succeeds the consumer owns 'n', so it must not be read again
+        Node * old = _head.load(std::memory_order_relaxed);
+        do {
+            n->next = old;
+        } while(!_head.compare_exchange_weak(old, n, std::memory_order_release, std::memory_order_relaxed));
+        return (old == nullptr) ? _efd.notify() : 0;
+    }
+
+    // Run everything queued so far, in the calling thread. Returns the number of
+    // tasks run.
+    size_t run_pending(){
+        Node * n = _head.exchange(nullptr, std::memory_order_acquire);
+
+        // The stack is newest first
+        Node * fifo = nullptr;
+        while(n){
+            Node * next = n->next;
+            n->next = fifo;
+            fifo = n;
+            n = next;
+        }
+        size_t count = 0;
+        while(fifo){
+            Node * next = fifo->next;
+            fifo->task();
+            delete fifo;
+            fifo = next;
+            ++count;
+        }
+        return count;
+    }
+
+    void on_event(const EpollEvent &) override {
+        _efd.consume();
+        run_pending();
+    }
+
+    int __fd() const { return _efd.__fd(); }
+private:
+    struct Node {
+        Task   task;
+        Node * next;
+    };
+    std::atomic<Node*> _head;
+    _unix::EventFd     _efd;
+};
+
+// Reactor on top of Epoll. Each registered file descriptor has a handler object. The
+// loop keeps a small record per registration (fd and handler), whose address is
+// stored in epoll_event.data.ptr. Dispatching is then just a virtual call, no lookups
+// needed; only add() and remove() touch the fd map.
+//
+// Registrations may be level- or edge-triggered (EpollEventType::EdgeTrigger); with
+// the latter the handler is expected to drain the fd until EAGAIN.
+//
+// The handler must outlive its registration. A handler may remove itself (or any
+// other handler) while it is being dispatched: events pending for a removed fd in
+// the current batch are dropped, also when its handler serves other fds too.
+// Deleting the handler object after remove() is then safe, even from within its
+// own on_event(). remove() takes the handler the fd was registered with, and fails
+// with EINVAL for any other.
+//
+// N is the largest number of events taken per wait; the buffer starts smaller and
+// adapts to the load (AdaptiveEventList).
+template <size_t N = 64>
+class EventLoop {
+    static_assert(N > 0, "EventLoop needs room for at least one event");
+public:
+    EventLoop(cpp::Flags<EpollFlag> fl = {EpollFlag::CloseOnExec})
+    : _epoll(fl), _evl(std::min<size_t>(16, N), N), _n(0), _i(0), _stop(false) { }
+
+    // RO3
+    EventLoop(const EventLoop &)            = delete;
+    EventLoop& operator=(const EventLoop &) = delete;
+
+    int add(const _unix::inet::Socket & s, EventHandler & h, cpp::Flags<EpollEventType> l){
+        return add(s.__fd(), h, l);
+    }
+    int modify(const _unix::inet::Socket & s, EventHandler & h, cpp::Flags<EpollEventType> l){
+        return modify(s.__fd(), h, l);
+    }
+    int remove(const _unix::inet::Socket & s, EventHandler & h){
+        return remove(s.__fd(), h);
+    }
+
+    int add(SignalHandler & h){
+        return add(h.signalfd().__fd(), h, {EpollEventType::Input});
+    }
+    int remove(SignalHandler & h){
+        return remove(h.signalfd().__fd(), h);
+    }
+
+    int add(TaskQueue & q){
+        return add(q.__fd(), q, {EpollEventType::Input});
+    }
+    int remove(TaskQueue & q){
+        return remove(q.__fd(), q);
+    }
+
+    int add(int fd, EventHandler & h, cpp::Flags<EpollEventType> l){
+        std::unique_ptr<Registration> r(new Registration{fd, &h});
+        int ret = _epoll.add(fd, l, _data(*r));
+        if(ret == 0){
+            // A record left by an fd that was closed without remove() is replaced
+            auto & slot = _regs[fd];
+            if(slot){
+                _drop(slot.get());
+            }
+            slot = std::move(r);
+        }
+        return ret;
+    }
+    int modify(int fd, EventHandler & h, cpp::Flags<EpollEventType> l){
+        auto it = _regs.find(fd);
+        if(it == _regs.end()){
+            errno = ENOENT;
+            return -1;
+        }
+        it->second->handler = &h;
+        return _epoll.modify(fd, l, _data(*it->second));
+    }
+    int remove(int fd, EventHandler & h){
+        auto it = _regs.find(fd);
+        if(it != _regs.end()){
+            if(it->second->handler != &h){
+                errno = EINVAL;
+                return -1;
+            }
+            _drop(it->second.get());
+            _regs.erase(it);
+        }
+        return _epoll.remove(fd);
+    }
+
+    // Wait for and dispatch a single batch of events. Returns the number of events
+    // received, 0 on timeout, or -1 and errno (EINTR is not considered an error).
+    int run_once(const Epoll::MilliSeconds & timeout){
+        return _dispatch(_epoll.wait(_evl, timeout));
+    }
+    // Nanosecond timeout, see Epoll::wait()
+    int run_once(const Epoll::NanoSeconds & timeout){
+        return _dispatch(_epoll.wait(_evl, timeout, _mask ? &*_mask : nullptr));
+    }
+    int run_once_blocking(){
+        if(_spin.count() > 0){
+            return _dispatch(_epoll.wait_spin(_evl, _spin, nullptr, _mask ? &*_mask : nullptr));
+        }
+        return _dispatch(_epoll.wait_blocking(_evl, _mask ? &*_mask : nullptr));
+    }
+
+    // Spin-then-block: run_once_blocking() (and run()) first polls for up to 'spin'
+    // before sleeping. Zero (the default) turns it off. See Epoll::wait_spin().
+    void set_spin(const Epoll::NanoSeconds & spin){ _spin = spin; }
+
+    // Signal mask to install atomically while blocked in run_once_blocking(),
+    // run() and the nanosecond run_once(). Nothing restores the plain wait.
+    void set_wait_sigmask(const Maybe<_unix::signals::SigSet> & mask){ _mask = mask; }
+
+    // Dispatch until stop() is called. 'timeout' bounds how long it may take to notice.
+    int run(const Epoll::MilliSeconds & timeout){
+        _stop = false;
+        while(!_stop){
+            if(run_once(timeout) < 0){
+                return -1;
+            }
+        }
+        return 0;
+    }
+    // Dispatch until stop() is called from a handler (e.g. one listening on an EventFd)
+    int run(){
+        _stop = false;
+        while(!_stop){
+            if(run_once_blocking() < 0){
+                return -1;
+            }
+        }
+        return 0;
+    }
+    void stop(){ _stop = true; }
+
+    Epoll & epoll() { return _epoll; }
+
+private:
+    struct Registration {
+        int            fd;
+        EventHandler * handler;
+    };
+
+    static EpollUserData _data(Registration & r){
+        EpollUserData d;
+        d.set_ptr(&r);
+        return d;
+    }
+
+    // Drop events still waiting for dispatch in this batch
+    void _drop(const Registration * r){
+        for(int j = _i; j < _n; ++j){
+            if(_evl[j].data.ptr == r){
+                _evl[j].data.ptr = nullptr;
+            }
+        }
+    }
+
+    int _dispatch(int n){
+        if(n < 0){
+            return (errno == EINTR) ? 0 : -1;
+        }
+        _n = n;
+        for(_i = 0; _i < _n; ){
+            const auto & ev = _evl[_i++];
+            auto * r = static_cast<Registration*>(ev.data.ptr);
+            if(r != nullptr){
+                r->handler->on_event(ev);
+            }
+        }
+        _n = _i = 0;
+        return n;
+    }
+
+    Epoll                         _epoll;
+    AdaptiveEventList             _evl;
+    std::unordered_map<int, std::unique_ptr<Registration>> _regs;
+    Maybe<_unix::signals::SigSet> _mask;
+    Epoll::NanoSeconds            _spin{0};
+    int                           _n;    // events in the current batch
+    int                           _i;    // next event to dispatch
+    bool                          _stop;
+};
+
 } // ns epoll
 
 } // ns _unix
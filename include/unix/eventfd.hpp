@@ -0,0 +1,64 @@
+#pragma once
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <stdexcept>
+
+#include <cpp.hpp>
+#include <unix/common.hpp>
+
+namespace _unix {
+
+enum class EventFdFlag {
+    CloseOnExec = EFD_CLOEXEC,
+    NonBlock    = EFD_NONBLOCK,
+    Semaphore   = EFD_SEMAPHORE,
+};
+
+// Kernel maintained 64-bit counter, usable as a wakeup primitive: write() adds to the
+// counter and makes the fd readable, read() returns the counter and resets it.
+// Register __fd() with Epoll for Input events.
+class EventFd {
+public:
+    EventFd(unsigned initval = 0,
+            cpp::Flags<EventFdFlag> fl = {EventFdFlag::CloseOnExec, EventFdFlag::NonBlock})
+    : _fd(::eventfd(initval, cpp::to_int(fl)))
+    {
+        if(_fd < 0){
+            throw std::runtime_error("eventfd(): " + _unix::errno_str(errno));
+        }
+    }
+    ~EventFd(){
+        if(_fd >= 0){
+            ::close(_fd);
+            _fd = -1;
+        }
+    }
+
+    // RO3
+    EventFd(const EventFd &)            = delete;
+    EventFd& operator=(const EventFd &) = delete;
+    EventFd(EventFd && o) : _fd(o._fd) { o._fd = -1; }
+    EventFd& operator=(EventFd && o) { std::swap(_fd, o._fd); return *this; }
+
+    // Add 'v' to the counter. Returns 0 or -1 and errno.
+    int notify(uint64_t v = 1){
+        return (::write(_fd, &v, sizeof(v)) == sizeof(v)) ? 0 : -1;
+    }
+
+    // Read and reset the counter (or decrement by one, with EventFdFlag::Semaphore).
+    // Nothing if the counter was zero (non-blocking mode) or on error.
+    cpp::Maybe<uint64_t> consume(){
+        uint64_t v = 0;
+        if(::read(_fd, &v, sizeof(v)) != sizeof(v)){
+            return cpp::Nothing();
+        }
+        return v;
+    }
+
+    int __fd() const { return _fd; }
+private:
+    int _fd;
+};
+
+} // ns _unix
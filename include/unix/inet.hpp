@@ -2,16 +2,23 @@
 
 #include <string>
 #include <vector>
+#include <chrono>
 #include <type_traits>
 #include <map>
+#include <array>
+#include <deque>
 
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <linux/errqueue.h>
 #include <cassert>
+#include <cerrno>
 
 #include <iostream>
 #include <algorithm>
@@ -19,6 +26,8 @@
 #include <cpp.hpp>
 #include <unix/common.hpp>
 #include <unix/inet_common.hpp>
+#include <unix/bufpool.hpp>
+#include <unix/pipe.hpp>
 
 namespace _unix
 {
@@ -28,12 +37,30 @@ namespace inet
 
 using namespace cpp;
 
+// Result of the format_* functions, modeled after std::to_chars_result. On success
+// 'ptr' is one past the last character written (no NUL terminator is written).
+// On failure 'ok' is false and 'ptr' == last.
+struct FormatResult {
+    char * ptr;
+    bool   ok;
+};
+
 class SockAddr {
 public:
 
     static Maybe<SockAddr> from_struct(const struct sockaddr_storage &, socklen_t, bool verify=true);
     static Maybe<SockAddr> from_struct(const struct sockaddr *, socklen_t, bool verify=true);
 
+    // AF_UNIX addresses. Nothing (and ENAMETOOLONG) if the name does not fit in
+    // sun_path. A filesystem path:
+    static Maybe<SockAddr> unix_path(const std::string & path);
+    // A name in the Linux abstract namespace: not in the filesystem, and released
+    // when the last socket bound to it is closed. Formatted as "@name".
+    static Maybe<SockAddr> unix_abstract(const std::string & name);
+
+    // AF_UNIX address in the abstract namespace
+    bool is_abstract() const;
+
     const struct sockaddr* addr() const;
 
     socklen_t addrlen() const;
@@ -43,17 +70,46 @@ public:
     // Port numbers can really be enumerated..
     uint16_t port() const;
 
+    // Upper bounds for the format_* functions. A buffer this large always suffices.
+    // AF_UNIX addresses have no port, but may be longer than IP addresses.
+    static constexpr size_t max_unix_len             = sizeof(sockaddr_un::sun_path) + 1;   // "@name"
+    static constexpr size_t max_address_len          = std::max<size_t>(INET6_ADDRSTRLEN, max_unix_len);
+    static constexpr size_t max_address_and_port_len = std::max<size_t>(INET6_ADDRSTRLEN + 2 + 1 + 5,   // "[addr]:65535"
+                                                                        max_unix_len);
+
+    using AddressBuffer = std::array<char, max_address_and_port_len>;
+
+    // Allocation-free formatting into [first, last), in the std::to_chars style
+    FormatResult format_address(char * first, char * last) const;
+    FormatResult format_address_and_port(char * first, char * last) const;
+
+    // Thin wrappers around the above
     std::string address() const;
+    std::string address_and_port() const;
     std::string to_string(int level=0) const;
 
-    std::string address_and_port() const {
-        if(family() == AddressFamily::IPv6){
-            return "[" + address() + "]:" + std::to_string(port());
+    // Streams "address:port" without temporary strings: os << sa.endpoint(). An
+    // address of a family format_address() does not know shows as "<unknown family>".
+    class Endpoint {
+    public:
+        explicit Endpoint(const SockAddr & sa) : _sa(sa) {}
+        friend std::ostream & operator<<(std::ostream & os, const Endpoint & e){
+            AddressBuffer buf;
+            auto r = e._sa.format_address_and_port(buf.data(), buf.data() + buf.size());
+            if(!r.ok){
+                return os << "<unknown family>";     // and not whatever the buffer held
+            }
+            return os.write(buf.data(), r.ptr - buf.data());
         }
-        return address() + ":" + std::to_string(port());
-    }
-
-    bool operator==(const SockAddr o){ return o.address() == address() && o.port() == port(); }
+    private:
+        const SockAddr & _sa;
+    };
+    Endpoint endpoint() const { return Endpoint(*this); }
+
+    // Compares family, address, port and IPv6 scope without formatting anything,
+    // like PeerAddr does
+    bool operator==(const SockAddr & o) const;
+    bool operator!=(const SockAddr & o) const { return !(*this == o); }
 private:
     // Don't make it directly. Let other interfaces create SockAddrs for you.
     SockAddr();
@@ -68,6 +124,70 @@ private:
     struct sockaddr_storage _ss;
 };
 
+// Compact IPv4/IPv6 endpoint: raw address bytes, port, and IPv6 scope id in 24 bytes
+// (vs. 128+ for SockAddr). Meant to be used as a key in per-peer tables: equality and
+// ordering are a handful of integer compares, and std::hash<PeerAddr> is provided.
+//
+// IPv4 addresses occupy the first word, the rest is zero. The IPv6 flow label is
+// not stored; it describes a packet, not an endpoint.
+class PeerAddr {
+public:
+    constexpr PeerAddr() : _w{0, 0, 0, 0}, _scope(0), _port(0), _family(0), _pad(0) {}
+
+    // Nothing if 'sa' is not an IPv4 or IPv6 address
+    static Maybe<PeerAddr> from(const SockAddr & sa);
+    static Maybe<PeerAddr> from(const struct sockaddr * sa, socklen_t len);
+
+    SockAddr to_sockaddr() const;
+
+    AddressFamily family() const { return static_cast<AddressFamily>(_family); }
+    uint16_t      port()   const { return _port; }
+
+    constexpr bool operator==(const PeerAddr & o) const {
+        return _w[0] == o._w[0] && _w[1] == o._w[1] && _w[2] == o._w[2] && _w[3] == o._w[3]
+            && _port == o._port && _family == o._family && _scope == o._scope;
+    }
+    constexpr bool operator!=(const PeerAddr & o) const { return !(*this == o); }
+
+    // Arbitrary but consistent order: family, address, port, scope
+    constexpr bool operator<(const PeerAddr & o) const {
+        return (_family != o._family) ? _family < o._family
+             : (_w[0]   != o._w[0])   ? _w[0]   < o._w[0]
+             : (_w[1]   != o._w[1])   ? _w[1]   < o._w[1]
+             : (_w[2]   != o._w[2])   ? _w[2]   < o._w[2]
+             : (_w[3]   != o._w[3])   ? _w[3]   < o._w[3]
+             : (_port   != o._port)   ? _port   < o._port
+             : _scope < o._scope;
+    }
+
+    constexpr uint64_t hash() const {
+        return _mix(_word(0) ^ _mix(_word(1) ^ _mix(
+            (uint64_t(_scope) << 32) | (uint64_t(_port) << 8) | _family)));
+    }
+
+private:
+    // Finalizer of MurmurHash3: every input bit affects every output bit
+    static constexpr uint64_t _mix(uint64_t x){
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+    constexpr uint64_t _word(int i) const {
+        return (uint64_t(_w[2*i]) << 32) | _w[2*i + 1];
+    }
+
+    uint32_t _w[4];     // network byte order
+    uint32_t _scope;
+    uint16_t _port;     // host byte order
+    uint8_t  _family;
+    uint8_t  _pad;
+};
+static_assert(sizeof(PeerAddr) == 24, "PeerAddr should stay compact");
+
 class AddrInfo {
 public:
 
@@ -75,14 +195,14 @@ public:
         AddressFamily af = AddressFamily::Any,
         SocketType type  = SocketType::Any,
         Protocol proto   = Protocol::Any,
-        const std::vector<AIFlag> & flags = {}
+        Flags<AIFlag> flags = {}
     );
 
     void set_params(
         AddressFamily af,
         SocketType st,
         Protocol pt,
-        const std::vector<AIFlag> & flags
+        Flags<AIFlag> flags
     );
 
     // You should only pass values defined in the enum classes.
@@ -92,7 +212,7 @@ public:
     void set_socktype(SocketType st);
     void set_protocol(Protocol proto);
     void set_flag(AIFlag f);
-    void set_flags(const std::vector<AIFlag> & fv);
+    void set_flags(Flags<AIFlag> fl);
 
     // Since an object of this class should not be possible to construct
     // without bypassing the type system, we assume the struct values are valid,
@@ -106,7 +226,7 @@ public:
     // If the AddfInfo does not have an associated sockaddr, this will return 0.
     socklen_t     addr_len() const;
 
-    std::vector<AIFlag> flags() const;
+    Flags<AIFlag> flags() const;
 
     std::string family_s()      const;
     std::string socket_type_s() const;
@@ -134,11 +254,368 @@ private:
     AddressFamily       _af;
     SocketType          _st;
     Protocol            _pt;
-    std::vector<AIFlag> _flags;
+    Flags<AIFlag>       _flags;
     Maybe<std::string>  _cn;
     Maybe<SockAddr>     _sa;
 };
 
+// Fixed capacity batch of datagrams for Socket::recvmmsg() and Socket::sendmmsg().
+// Much like EventList for Epoll, the size is a compile time constant.
+//
+// Each slot points to a caller-owned buffer (set_buffer). After recvmmsg() the slots
+// [0, size()) contain the received datagrams, with per-message source address, length
+// and flags. For sendmmsg(), fill in length and (optionally) destination for each
+// slot, set the batch size with resize() and pass the batch along.
+//
+// The iovec/msghdr pointers are rebuilt on every call, so the object can be copied
+// and moved freely. The buffers themselves must of course outlive the batch.
+//
+// WARNING: do not specify N = 0
+template <size_t N>
+class MsgBatch {
+public:
+    MsgBatch() : _count(0), _hdrs{}, _iov{}, _ss{}, _cap{} {}
+
+    static constexpr size_t capacity() { return N; }
+
+    // Number of valid messages in the batch
+    size_t size() const { return _count; }
+    bool  empty() const { return _count == 0; }
+
+    void resize(size_t n) {
+        assert(n <= N);
+        _count = n;
+    }
+    void clear() { _count = 0; }
+
+    // Associate slot 'i' with a buffer of 'cap' bytes. The buffer is used for
+    // receiving, or as the payload when sending.
+    void set_buffer(size_t i, uint8_t * buf, size_t cap){
+        assert(i < N);
+        _iov[i].iov_base = buf;
+        _iov[i].iov_len  = cap;
+        _cap[i] = cap;
+    }
+
+    // Use a pool buffer for slot 'i'. The batch does not hold a reference: keep
+    // the handle alive, and copy length(i) to it with set_size() after receiving.
+    void set_buffer(size_t i, PoolBuffer & b){
+        set_buffer(i, b.data(), b.capacity());
+    }
+
+    uint8_t * data(size_t i) const { return static_cast<uint8_t*>(_iov[i].iov_base); }
+
+    // Received length (after recvmmsg) or the length to send (set_length).
+    size_t length(size_t i) const { return _iov[i].iov_len; }
+    void set_length(size_t i, size_t n){
+        assert(n <= _cap[i]);
+        _iov[i].iov_len = n;
+    }
+
+    // Source address after recvmmsg(), or destination set with set_address()
+    Maybe<SockAddr> address(size_t i) const {
+        return SockAddr::from_struct(_ss[i], _hdrs[i].msg_hdr.msg_namelen);
+    }
+    void set_address(size_t i, const SockAddr & sa){
+        assert(i < N);
+        memcpy(&_ss[i], sa.addr(), sa.addrlen());
+        _hdrs[i].msg_hdr.msg_namelen = sa.addrlen();
+    }
+    // Send slot 'i' to the connected peer instead
+    void clear_address(size_t i){ _hdrs[i].msg_hdr.msg_namelen = 0; }
+
+    bool has_flag(size_t i, MsgFlag f) const {
+        return _hdrs[i].msg_hdr.msg_flags & cpp::to_underlying(f);
+    }
+
+    // Used by Socket. Prepares all slots for a recvmmsg call.
+    struct mmsghdr * _prepare_recv(){
+        for(size_t i = 0; i < N; ++i){
+            auto & h = _hdrs[i].msg_hdr;
+            h = {};
+            _iov[i].iov_len = _cap[i];
+            h.msg_iov     = &_iov[i];
+            h.msg_iovlen  = 1;
+            h.msg_name    = &_ss[i];
+            h.msg_namelen = sizeof(_ss[i]);
+            _hdrs[i].msg_len = 0;
+        }
+        return _hdrs.data();
+    }
+    // Used by Socket. Records the results of recvmmsg
+    void _complete_recv(int n){
+        _count = (n > 0) ? n : 0;
+        for(size_t i = 0; i < _count; ++i){
+            _iov[i].iov_len = _hdrs[i].msg_len;
+        }
+    }
+    // Used by Socket. Prepares slots [first, size()) for a sendmmsg call.
+    struct mmsghdr * _prepare_send(size_t first){
+        for(size_t i = first; i < _count; ++i){
+            auto & h = _hdrs[i].msg_hdr;
+            auto namelen = h.msg_namelen;
+            h = {};
+            h.msg_iov     = &_iov[i];
+            h.msg_iovlen  = 1;
+            h.msg_name    = (namelen > 0) ? &_ss[i] : nullptr;
+            h.msg_namelen = namelen;
+            _hdrs[i].msg_len = 0;
+        }
+        return _hdrs.data() + first;
+    }
+
+private:
+    size_t                                 _count;
+    std::array<struct mmsghdr, N>          _hdrs;
+    std::array<struct iovec, N>            _iov;
+    std::array<struct sockaddr_storage, N> _ss;
+    std::array<size_t, N>                  _cap;
+};
+
+// Non-owning view to a contiguous range of bytes
+struct ByteView {
+    const uint8_t * data;
+    size_t          size;
+};
+
+// Splits a receive buffer coalesced by UDP GRO into the original datagrams.
+// All segments are 'segment_size' bytes long, except possibly the last one.
+// A segment size of 0 means the buffer was not coalesced, i.e. it is a single datagram.
+class GroSegments {
+public:
+    GroSegments(const uint8_t * buf, size_t len, size_t segment_size)
+    : _buf(buf), _len(len), _seg((segment_size == 0) ? len : segment_size) {}
+
+    size_t count() const { return (_seg == 0) ? 0 : (_len + _seg - 1) / _seg; }
+
+    ByteView operator[](size_t i) const {
+        size_t off = i * _seg;
+        return ByteView{_buf + off, std::min(_seg, _len - off)};
+    }
+
+    class iterator {
+    public:
+        iterator(const GroSegments & g, size_t i) : _g(g), _i(i) {}
+        ByteView operator*() const { return _g[_i]; }
+        iterator & operator++() { ++_i; return *this; }
+        bool operator!=(const iterator & o) const { return _i != o._i; }
+    private:
+        const GroSegments & _g;
+        size_t _i;
+    };
+    iterator begin() const { return iterator(*this, 0); }
+    iterator end()   const { return iterator(*this, count()); }
+
+private:
+    const uint8_t * _buf;
+    size_t          _len;
+    size_t          _seg;
+};
+
+// Result of Socket::recvfrom_gro()
+struct GroRecv {
+    ssize_t         bytes;          // total bytes received, or -1 (see errno)
+    uint16_t        segment_size;   // 0 if the datagram was not coalesced
+    Maybe<SockAddr> from;
+};
+
+// A descriptor received with SCM_RIGHTS (ControlMessages::take_fds()). Owns it:
+// it is closed on destruction, unless release()d or adopted by Socket::adopt().
+class ReceivedFd {
+public:
+    explicit ReceivedFd(int fd) : _fd(fd) {}
+    ~ReceivedFd();
+
+    // RO3
+    ReceivedFd(const ReceivedFd &)            = delete;
+    ReceivedFd& operator=(const ReceivedFd &) = delete;
+    ReceivedFd(ReceivedFd && o) : _fd(o.release()) {}
+    ReceivedFd& operator=(ReceivedFd && o) { std::swap(_fd, o._fd); return *this; }
+
+    // The caller becomes responsible for closing it
+    int release() { int fd = _fd; _fd = -1; return fd; }
+
+    int __fd() const { return _fd; }
+private:
+    int _fd;
+};
+
+// Kernel timestamps of one packet, since the epoch. Software stamps are
+// CLOCK_REALTIME; hardware stamps use the NIC clock, which is only comparable to it
+// when synchronized (e.g. by PTP). Zero if not reported.
+struct Timestamp {
+    std::chrono::nanoseconds software{0};
+    std::chrono::nanoseconds hardware{0};
+};
+
+// A TX timestamp read from the socket error queue (Socket::reap_tx_timestamps())
+struct TxTimestamp {
+    TxStamp   type;
+    uint32_t  id;       // with TimestampFlag::OptId: datagram counter (UDP) or byte offset (TCP)
+    Timestamp time;
+};
+
+// Control messages (ancillary data) of one received message, or of one to send.
+// Owns the buffer, so it may be kept around. Iterate over the raw cmsghdrs, or use
+// the typed accessors, which return Nothing if the message is absent.
+class ControlMessages {
+public:
+    // Enough for GRO, timestamps and an extended error with its address, or
+    // about a hundred descriptors
+    static constexpr size_t capacity = 512;
+
+    ControlMessages() : _len(0) {}
+
+    class iterator {
+    public:
+        iterator(const ControlMessages & c, const struct cmsghdr * cm) : _c(c), _cm(cm) {}
+        const struct cmsghdr & operator*()  const { return *_cm; }
+        const struct cmsghdr * operator->() const { return _cm; }
+        iterator & operator++() { _cm = _c._next(_cm); return *this; }
+        bool operator!=(const iterator & o) const { return _cm != o._cm; }
+    private:
+        const ControlMessages & _c;
+        const struct cmsghdr *  _cm;
+    };
+    iterator begin() const { return iterator(*this, _next(nullptr)); }
+    iterator end()   const { return iterator(*this, nullptr); }
+    bool empty()     const { return _next(nullptr) == nullptr; }
+
+    // Payload of 'cm' as a T. Nothing if it is too short.
+    template <typename T>
+    static Maybe<T> payload(const struct cmsghdr & cm){
+        if(cm.cmsg_len < CMSG_LEN(sizeof(T))){
+            return Nothing();
+        }
+        T v;
+        memcpy(&v, CMSG_DATA(&cm), sizeof(T));
+        return v;
+    }
+    // Payload of the first message with 'level' and 'type'
+    template <typename T>
+    Maybe<T> find(int level, int type) const {
+        for(auto & cm : *this){
+            if(cm.cmsg_level == level && cm.cmsg_type == type){
+                return payload<T>(cm);
+            }
+        }
+        return Nothing();
+    }
+
+    // UDP_GRO segment size
+    Maybe<uint16_t> gro_segment_size() const;
+    // SCM_TIMESTAMPNS or SCM_TIMESTAMPING
+    Maybe<Timestamp> timestamp() const;
+    // IP_RECVERR / IPV6_RECVERR, from the error queue
+    Maybe<struct sock_extended_err> extended_error() const;
+    // SCM_CREDENTIALS of the sender; the receiver needs Socket::set_passcred(true)
+    Maybe<struct ucred> credentials() const;
+
+    // SCM_RIGHTS: move the descriptors passed by the peer into 'out' (appended), and
+    // return their count. A second call finds none. Descriptors that are never taken
+    // stay open, as with recvmsg(2) itself, so take them even if they are not wanted.
+    size_t take_fds(std::vector<ReceivedFd> & out);
+
+    // For sending (Socket::sendmsg()). Each appends one message and returns false,
+    // leaving the buffer unchanged, if it does not fit.
+    bool add(int level, int type, const void * data, size_t len);
+    // SCM_RIGHTS over AF_UNIX: the receiver gets duplicates of 'fds', which stay
+    // open here. A stream socket must send at least one byte of data with them.
+    bool add_fds(const int * fds, size_t n);
+    bool add_fds(std::initializer_list<int> fds) { return add_fds(fds.begin(), fds.size()); }
+    // SCM_CREDENTIALS: our own pid, uid and gid. Other values need privileges.
+    bool add_credentials();
+    bool add_credentials(const struct ucred & c);
+
+    void clear() { _len = 0; }
+
+    // Used by Socket
+    void * _data() { return _buf; }
+    const void * _data() const { return _buf; }
+    size_t _length() const { return _len; }
+    void _set_length(size_t n) { _len = n; }
+
+private:
+    // First message if 'cm' is null, otherwise the one after 'cm'
+    const struct cmsghdr * _next(const struct cmsghdr * cm) const {
+        struct msghdr mh = {};
+        mh.msg_control    = const_cast<char*>(_buf);
+        mh.msg_controllen = _len;
+        return cm ? CMSG_NXTHDR(&mh, const_cast<struct cmsghdr*>(cm)) : CMSG_FIRSTHDR(&mh);
+    }
+
+    alignas(struct cmsghdr) char _buf[capacity];
+    size_t _len;
+};
+
+// Result of Socket::recvmsg()
+struct RecvMsg {
+    ssize_t         bytes = -1;     // bytes received, or -1 (see errno)
+    int             flags = 0;      // msghdr.msg_flags, see has_flag()
+    Maybe<SockAddr> from;
+    ControlMessages control;
+
+    bool has_flag(MsgFlag f) const { return flags & cpp::to_underlying(f); }
+
+    // Kernel receive timestamp, with set_timestamp_ns() or set_timestamping()
+    Maybe<Timestamp> timestamp() const { return control.timestamp(); }
+};
+
+// Tracks buffers sent with Socket::send_zerocopy()/sendto_zerocopy().
+//
+// With MSG_ZEROCOPY the kernel keeps reading the buffer after the send call has
+// returned, so the buffer must not be touched until the kernel says it is done.
+// To make that hard to get wrong, the queue takes ownership of the buffer, and
+// only hands it back through take_completed() once the completion notification has
+// been read from the socket error queue (Socket::reap_zerocopy()).
+//
+// Completions arrive as EpollEventType::Error on the socket.
+//
+// The kernel numbers the zerocopy sends of each socket, and the queue mirrors that
+// counter: use exactly one queue per socket, for all of its zerocopy sends.
+class ZeroCopyQueue {
+public:
+    using Buffer = std::vector<uint8_t>;
+
+    ZeroCopyQueue() : _next_id(0), _copied(false), _unsent(0) {}
+
+    // Buffers still owned by the kernel
+    size_t in_flight() const { return _pending.size(); }
+
+    // Move all completed buffers into 'out' (appended). Returns the count.
+    size_t take_completed(std::vector<Buffer> & out);
+
+    // True if the kernel reported it had to fall back to copying (e.g. on loopback).
+    // Zero-copy is then pure overhead for this socket.
+    bool copied() const { return _copied; }
+
+    // Bytes of the most recently queued buffer that a partial (stream) send left
+    // over. Send them with Socket::send_zerocopy_rest() before anything else.
+    size_t unsent() const { return _unsent; }
+
+    // Used by Socket
+    void _push(Buffer && b, size_t sent);
+    // Records one more send of the tail of the last buffer
+    void _push_rest(size_t sent);
+    const uint8_t * _rest() const { return _pending.back().buf.data() + _pending.back().buf.size() - _unsent; }
+    void _complete(uint32_t lo, uint32_t hi, bool copied);
+
+private:
+    // A buffer sent in several parts has one entry per send; the buffer moves along
+    // to the last one, so it is handed back only when every part is done
+    struct Entry {
+        uint32_t id;
+        bool     done;
+        Buffer   buf;
+    };
+    uint32_t          _next_id;     // the kernel numbers zerocopy sends from 0
+    bool              _copied;
+    size_t            _unsent;
+    std::deque<Entry> _pending;
+    std::vector<Buffer> _done;
+};
+
+struct Connection;
 
 class Socket {
 public:
@@ -146,7 +623,8 @@ public:
     //
     // You should NOT be able to make sockets manually from an integer (socket
     // handle / descriptor), so don't even think about writing a Socket::Socket(int fd) !
-    Socket(const AddrInfo & info);
+    // (accept() does it internally, from a descriptor the kernel just handed out.)
+    Socket(const AddrInfo & info, Flags<SocketFlag> fl = {});
 
     // RO3: Rule of Three (or Five) - prevent socket class copying
     Socket(const Socket & )             = delete;
@@ -156,14 +634,49 @@ public:
     Socket(Socket && o){ *this = std::move(o); }
     Socket & operator=(Socket && o) { _sock = o._sock; o._sock = -1; return *this;}
 
-    Socket(AddressFamily af, SocketType st, Protocol pt);
+    Socket(AddressFamily af, SocketType st, Protocol pt, Flags<SocketFlag> fl = {});
     ~Socket();
 
+    // socketpair(2): two AF_UNIX sockets connected to each other, e.g. to talk to a
+    // child process. Nothing and errno on failure.
+    static Maybe<std::pair<Socket, Socket>> socketpair(
+        SocketType st = SocketType::Datagram,
+        Flags<SocketFlag> fl = {SocketFlag::CloseOnExec}
+    );
+
+    // A socket received from another process (SCM_RIGHTS). Nothing and errno
+    // (ENOTSOCK) if it is not a socket, in which case 'fd' keeps it.
+    static Maybe<Socket> adopt(ReceivedFd && fd);
+
     int bind(const AddrInfo & ai);
     int bind(const SockAddr & ai);
 
     int listen(int backlog);
 
+    // Accept one pending connection with accept4(). The flags are applied to the new
+    // socket atomically. Nothing and errno on failure; EAGAIN (or EWOULDBLOCK) on a
+    // non-blocking listener means the backlog is empty.
+    Maybe<Connection> accept(Flags<SocketFlag> fl = {SocketFlag::NonBlock, SocketFlag::CloseOnExec});
+
+    // Accept until the backlog is drained (EAGAIN), calling f(Connection &&) for
+    // each one. Meant for a non-blocking listener on each Epoll Input event, which is
+    // required with EpollEventType::EdgeTrigger. Connections aborted by the peer
+    // before being accepted are skipped, and so are the network errors accept(2)
+    // passes on for a pending connection (ENETDOWN, EPROTO, EHOSTUNREACH, ...):
+    // they concern that one connection, not the listener.
+    //
+    // Returns the number of connections accepted. If accept4() fails for another
+    // reason (e.g. EMFILE), returns that count, or -1 if it is 0, with errno set.
+    template <typename F>
+    int accept_all(F && f, Flags<SocketFlag> fl = {SocketFlag::NonBlock, SocketFlag::CloseOnExec});
+
+    // TCP_DEFER_ACCEPT: wake the listener only once data has arrived on a new
+    // connection, waiting at most about 'seconds'.
+    int set_defer_accept(int seconds);
+
+    // TCP_NODELAY: disable Nagle's algorithm
+    int set_nodelay(bool on);
+
     int connect(const AddrInfo &);
     int connect(const SockAddr &);
 
@@ -172,14 +685,30 @@ public:
     ssize_t recv(
         uint8_t * buf,
         ssize_t buflen,
-        const std::initializer_list<RecvFlag> & fl = {}
+        Flags<RecvFlag> fl = {}
     )
     {
         return ::recv(_sock, reinterpret_cast<unsigned char*>(buf), buflen, cpp::to_int(fl));
     }
 
+    // Receive into a pool buffer; on success its size() is set to the received length
+    ssize_t recv(PoolBuffer & b, Flags<RecvFlag> fl = {})
+    {
+        auto ret = recv(b.data(), b.capacity(), fl);
+        b.set_size((ret > 0) ? ret : 0);
+        return ret;
+    }
+
     std::pair<ssize_t, Maybe<SockAddr>>
-    recvfrom(uint8_t * buf, ssize_t buflen, const std::initializer_list<RecvFlag> & f = {})
+    recvfrom(PoolBuffer & b, Flags<RecvFlag> fl = {})
+    {
+        auto p = recvfrom(b.data(), b.capacity(), fl);
+        b.set_size((p.first > 0) ? p.first : 0);
+        return p;
+    }
+
+    std::pair<ssize_t, Maybe<SockAddr>>
+    recvfrom(uint8_t * buf, ssize_t buflen, Flags<RecvFlag> f = {})
     {
         // If you are using recvfrom, you obviously want these filled in, don't cha?
         struct sockaddr_storage ss = {};
@@ -192,24 +721,113 @@ public:
         return std::make_pair(ret, SockAddr::from_struct(ss, len));
     }
 
+    // Receive up to N datagrams with a single syscall. Returns the number of messages
+    // received (also available as batch.size()), or -1 and errno. A partial batch is
+    // not an error: RecvFlag::WaitForOne or RecvFlag::DontWait return whatever is
+    // available.
+    template <size_t N>
+    int recvmmsg(MsgBatch<N> & batch, Flags<RecvFlag> fl = {})
+    {
+        auto ret = ::recvmmsg(_sock, batch._prepare_recv(), N, cpp::to_int(fl), nullptr);
+        batch._complete_recv(ret);
+        return ret;
+    }
+
+    // Send messages [first, batch.size()) with a single syscall. Returns the number of
+    // messages sent, or -1 and errno if none was. If the return value is less than
+    // what was requested, call again with 'first' advanced by that amount.
+    template <size_t N>
+    int sendmmsg(MsgBatch<N> & batch, size_t first = 0, Flags<SendFlag> fl = {})
+    {
+        if(first >= batch.size()){
+            return 0;
+        }
+        return ::sendmmsg(_sock, batch._prepare_send(first), batch.size() - first, cpp::to_int(fl));
+    }
+
     Maybe<SockAddr> getsockname() const;
     Maybe<SockAddr> getpeername() const;
 
-    ssize_t sendto(const uint8_t * buf, size_t len, const SockAddr & dest, const std::initializer_list<SendFlag> & fl = {})
+    ssize_t sendto(const uint8_t * buf, size_t len, const SockAddr & dest, Flags<SendFlag> fl = {})
     {
         return ::sendto(_sock, buf, len, cpp::to_int(fl), dest.addr(), dest.addrlen());
     }
 
     // needs to be connect()'ed first
-    ssize_t send(const uint8_t *buf, size_t buflen, const std::initializer_list<SendFlag> & fl = {}){
+    ssize_t send(const uint8_t *buf, size_t buflen, Flags<SendFlag> fl = {}){
         return ::send(_sock, reinterpret_cast<const void*>(buf), buflen, cpp::to_int(fl));
     }
 
+    // Sends b.size() bytes
+    ssize_t sendto(const PoolBuffer & b, const SockAddr & dest, Flags<SendFlag> fl = {})
+    {
+        return sendto(b.data(), b.size(), dest, fl);
+    }
+    ssize_t send(const PoolBuffer & b, Flags<SendFlag> fl = {}){
+        return send(b.data(), b.size(), fl);
+    }
+
     // needs to be connect()'ed first
-    ssize_t send(const std::string & s, const std::initializer_list<SendFlag> & fl = {}){
+    ssize_t send(const std::string & s, Flags<SendFlag> fl = {}){
         return send(reinterpret_cast<const uint8_t*>(s.data()), s.size(), fl);
     }
 
+    // UDP segmentation offload (GSO). Hands one large buffer to the kernel, which
+    // splits it into datagrams of 'segment_size' bytes (the last one may be shorter).
+    // Requires Linux >= 4.18. The buffer may hold at most 64 segments, and the total
+    // must fit in a single IP packet (64k). Returns bytes sent or -1 and errno.
+    ssize_t send_segmented(const uint8_t * buf, size_t len, uint16_t segment_size,
+                           Flags<SendFlag> fl = {});
+    ssize_t sendto_segmented(const uint8_t * buf, size_t len, uint16_t segment_size,
+                             const SockAddr & dest, Flags<SendFlag> fl = {});
+
+    // Default GSO segment size for all sends on this socket (UDP_SEGMENT).
+    // 0 turns it off.
+    int set_udp_segment(uint16_t segment_size);
+
+    // Allow the kernel to coalesce received datagrams of the same flow (UDP_GRO).
+    // Use recvfrom_gro() afterwards, otherwise datagram boundaries are lost.
+    int set_udp_gro(bool on);
+
+    // recvfrom() that also reports the GRO segment size. Split the buffer with
+    // GroSegments(buf, r.bytes, r.segment_size). The buffer should be at least 64k.
+    GroRecv recvfrom_gro(uint8_t * buf, size_t buflen, Flags<RecvFlag> fl = {});
+
+    // recvmsg(2): receive one message together with its control messages (GRO
+    // segment size, timestamps, ...). The source address is filled in if the
+    // socket is not connected.
+    RecvMsg recvmsg(uint8_t * buf, size_t buflen, Flags<RecvFlag> fl = {});
+    RecvMsg recvmsg(PoolBuffer & b, Flags<RecvFlag> fl = {})
+    {
+        auto r = recvmsg(b.data(), b.capacity(), fl);
+        b.set_size((r.bytes > 0) ? r.bytes : 0);
+        return r;
+    }
+
+    // sendmsg(2) with control messages, e.g. descriptors to pass to another
+    // process (ControlMessages::add_fds()). Bytes sent, or -1 and errno.
+    ssize_t sendmsg(const uint8_t * buf, size_t len, const ControlMessages & c, Flags<SendFlag> fl = {});
+    ssize_t sendmsg(const uint8_t * buf, size_t len, const ControlMessages & c, const SockAddr & dest,
+                    Flags<SendFlag> fl = {});
+
+    // SO_PASSCRED: receive the credentials of the sender with each message on an
+    // AF_UNIX socket (RecvMsg::control.credentials())
+    int set_passcred(bool on);
+    // SO_PEERCRED: credentials of the peer of a connected AF_UNIX socket, as of
+    // connect() or socketpair(). Nothing and errno on failure.
+    Maybe<struct ucred> peer_credentials() const;
+
+    // SO_TIMESTAMPNS: stamp each received packet with the (software) time it
+    // entered the stack; see RecvMsg::timestamp(). Comparing it with clock_now()
+    // after the receive gives the time spent queued in the kernel.
+    int set_timestamp_ns(bool on);
+
+    // SO_TIMESTAMPING: pick which RX and TX events to stamp and report, e.g.
+    // {RxSoftware, TxSoftware, Software, OptId, OptTsOnly}. RX stamps arrive with
+    // recvmsg(), TX stamps on the error queue (reap_tx_timestamps()). Hardware
+    // stamps also need the NIC to be configured (SIOCSHWTSTAMP). {} turns it off.
+    int set_timestamping(Flags<TimestampFlag> fl);
+
 
     int setsockopt(int level, int optname, const void* optval, socklen_t optlen) {
         // hmmm
@@ -219,13 +837,136 @@ public:
 
     bool setblocking(bool val);
 
+    // Opt in to MSG_ZEROCOPY transmission (SO_ZEROCOPY, Linux >= 4.14).
+    int set_zerocopy(bool on);
+
+    // Send without copying the payload into the kernel. If anything was sent, the
+    // buffer is moved into 'q', and given back by q.take_completed() when the kernel
+    // is done with it. Otherwise (0, or -1 and errno) 'buf' is left untouched.
+    // Requires set_zerocopy(true), and the same 'q' for every zerocopy send on this
+    // socket.
+    //
+    // A stream socket may send only part of the buffer; q.unsent() then tells how
+    // much is left, to be sent with send_zerocopy_rest() (e.g. on the next
+    // EpollEventType::Output).
+    ssize_t send_zerocopy(ZeroCopyQueue & q, ZeroCopyQueue::Buffer && buf,
+                          Flags<SendFlag> fl = {});
+    ssize_t send_zerocopy_rest(ZeroCopyQueue & q, Flags<SendFlag> fl = {});
+    ssize_t sendto_zerocopy(ZeroCopyQueue & q, ZeroCopyQueue::Buffer && buf, const SockAddr & dest,
+                            Flags<SendFlag> fl = {});
+
+    // Read completion notifications from the error queue into 'q'. Call when Epoll
+    // reports EpollEventType::Error. Returns the number of notifications read, or -1
+    // and errno.
+    int reap_zerocopy(ZeroCopyQueue & q);
+
+    // Read TX timestamps from the error queue into 'out' (appended). Call when Epoll
+    // reports EpollEventType::Error. Returns the number read, or -1 and errno.
+    int reap_tx_timestamps(std::vector<TxTimestamp> & out);
+
+    // Both of the above. The error queue is shared: with zerocopy and TX timestamps
+    // on the same socket, use this one, as the others discard what they do not want.
+    int reap_error_queue(ZeroCopyQueue & q, std::vector<TxTimestamp> & out);
+
+    // sendfile(2): send up to 'count' bytes of file 'fd' starting at 'offset', which
+    // is advanced past the bytes sent. The data does not pass through userspace.
+    // Returns bytes sent, 0 at end of file, or -1 and errno.
+    ssize_t sendfile(int fd, off_t & offset, size_t count);
+
+    // Repeat sendfile() until 'count' bytes are sent, the file ends, or an error.
+    // On a non-blocking socket it stops with Transfer::again when the send buffer is
+    // full; wait for EpollEventType::Output and call again with the remaining count
+    // (and the updated offset).
+    Transfer sendfile_all(int fd, off_t & offset, size_t count);
+
+    // Move up to 'len' bytes from 'p' into this socket, or from this socket into 'p'.
+    // Returns bytes moved, or -1 and errno (EAGAIN if the socket is non-blocking and
+    // not ready, or SpliceFlag::NonBlock was given and the pipe is not).
+    ssize_t splice_from(Pipe & p, size_t len, Flags<SpliceFlag> fl = {SpliceFlag::Move}){
+        return p.splice_to(_sock, len, fl);
+    }
+    ssize_t splice_to(Pipe & p, size_t len, Flags<SpliceFlag> fl = {SpliceFlag::Move}){
+        return p.splice_from(_sock, len, fl);
+    }
+
+    // Send 'count' bytes of file 'fd' starting at 'offset' through pipe 'p'
+    // (file -> pipe -> socket). Works where sendfile() does not, e.g. when the
+    // source is not mmap-able. SpliceFlag::More is added while more data follows.
+    //
+    // 'offset' advances as data enters the pipe. When the socket would block,
+    // the data may stay in 'p' and Transfer::again is set. Keep the pipe for this
+    // transfer, and call again on Output readiness with count reduced by
+    // Transfer::bytes: buffered bytes are sent first.
+    Transfer splice_all(int fd, off_t & offset, size_t count, Pipe & p,
+                        Flags<SpliceFlag> fl = {SpliceFlag::Move});
+
+    // SO_REUSEADDR / SO_REUSEPORT. With the latter, several sockets may bind to the
+    // same address, and the kernel hashes incoming flows across them.
+    int set_reuseaddr(bool on);
+    int set_reuseport(bool on);
+
+    // Busy polling: a blocking receive (or epoll wait, see Epoll::set_busy_poll())
+    // on this socket spins on the device queue for up to 'usecs' before sleeping.
+    // Trades CPU time for latency. SO_BUSY_POLL; raising it above the
+    // net.core.busy_read sysctl needs CAP_NET_ADMIN.
+    int set_busy_poll(std::chrono::microseconds usecs);
+    // SO_PREFER_BUSY_POLL (Linux >= 5.11): prefer busy polling over softirq
+    // processing of the device queue
+    int set_prefer_busy_poll(bool on);
+    // SO_BUSY_POLL_BUDGET (Linux >= 5.11): packets processed per busy poll
+    // round; raising it needs CAP_NET_ADMIN
+    int set_busy_poll_budget(int packets);
+
     // be careful. EXTREMELY careful. This is just to avoid circular dependencies
     // with other classes, such as Epoll
     int __fd() const { return _sock; }
 private:
+    struct _FromFd {};
+    Socket(int fd, _FromFd) : _sock(fd) {}
+
+    // Either may be null
+    int _reap_error_queue(ZeroCopyQueue * q, std::vector<TxTimestamp> * out);
+
     int _sock;
 };
 
+// A connection accepted by Socket::accept(), with the address of the peer
+struct Connection {
+    Socket          socket;
+    Maybe<SockAddr> peer;
+};
+
+template <typename F>
+int Socket::accept_all(F && f, Flags<SocketFlag> fl){
+    int n = 0;
+    while(true){
+        auto c = accept(fl);
+        if(c){
+            f(std::move(*c));
+            ++n;
+            continue;
+        }
+        switch(errno){
+            case EINTR:
+            case ECONNABORTED:
+            // Errors of the new connection, reported by accept() (see accept(2))
+            case ENETDOWN:
+            case EPROTO:
+            case ENOPROTOOPT:
+            case EHOSTDOWN:
+            case ENONET:
+            case EHOSTUNREACH:
+            case EOPNOTSUPP:
+            case ENETUNREACH:
+                continue;
+        }
+        if(errno == EAGAIN || errno == EWOULDBLOCK){
+            return n;
+        }
+        return (n > 0) ? n : -1;
+    }
+}
+
 std::vector<AddrInfo> getAddrInfo(
         const std::string & host,
         const AddrInfo& ai,
@@ -237,9 +978,12 @@ std::vector<AddrInfo> getAddrInfo(
         uint16_t service
 );
 
+// With 'reuseport', SO_REUSEPORT is set before bind(), so other sockets may bind
+// to the same address (see ShardedUdpServer).
 Maybe<Socket> server_socket_udp(
     const std::string & laddr,
-    const std::string & service = ""
+    const std::string & service = "",
+    bool reuseport = false
 );
 
 Maybe<Socket> client_socket_udp(
@@ -247,9 +991,45 @@ Maybe<Socket> client_socket_udp(
     const std::string & service = ""
 );
 
+// Listening TCP socket, created with SocketFlag::NonBlock and SocketFlag::CloseOnExec.
+// SO_REUSEADDR is always set; 'reuseport' sets SO_REUSEPORT so that several
+// listeners (threads) can share the address. A non-zero 'defer_accept' sets
+// TCP_DEFER_ACCEPT (seconds). Use Socket::accept_all() on Input events.
+Maybe<Socket> server_socket_tcp(
+    const std::string & laddr,
+    const std::string & service = "",
+    int backlog = SOMAXCONN,
+    bool reuseport = false,
+    int defer_accept = 0
+);
+
+// Connected (blocking) TCP socket
+Maybe<Socket> client_socket_tcp(
+    const std::string & raddr,
+    const std::string & service = ""
+);
+
+// AF_UNIX socket bound to 'local' (SockAddr::unix_path() or unix_abstract()), and
+// listening if 'st' is Stream or SeqPacket. A stale socket file at the path, one
+// nobody accepts connections on any more, is replaced; any other file is not.
+// The file is left behind on close, unlink() it when done.
+Maybe<Socket> server_socket_unix(
+    const SockAddr & local,
+    SocketType st = SocketType::Datagram,
+    int backlog = SOMAXCONN
+);
+
+// AF_UNIX socket connected to 'remote'. A Datagram socket is also bound to an
+// autogenerated abstract name, so the server can reply to it.
+Maybe<Socket> client_socket_unix(
+    const SockAddr & remote,
+    SocketType st = SocketType::Datagram
+);
+
 
 std::ostream & operator<<(std::ostream &, const inet::AddrInfo &);
 std::ostream & operator<<(std::ostream &, const inet::SockAddr &);
+std::ostream & operator<<(std::ostream &, const inet::PeerAddr &);   // "address:port"
 
 
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
@@ -257,3 +1037,10 @@ std::ostream & operator<<(std::ostream &, const inet::SockAddr &);
 } // end of ns inet
 
 } // unix
+
+namespace std {
+template <>
+struct hash<_unix::inet::PeerAddr> {
+    size_t operator()(const _unix::inet::PeerAddr & p) const { return p.hash(); }
+};
+}
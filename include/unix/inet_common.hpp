@@ -1,9 +1,15 @@
 #pragma once
 
+#include <time.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+
 #include <cpp.hpp>
 
 #include <string>
 #include <sstream>
+#include <ostream>
+#include <utility>
 
 using namespace cpp;
 
@@ -21,24 +27,37 @@ enum class AddressFamily : uint32_t {
     Any     = AF_UNSPEC,
     IPv4    = AF_INET,
     IPv6    = AF_INET6,
-    /* Unix = AF_UNIX */
+    Unix    = AF_UNIX,
 };
 using AddressFamilyCheck = cpp::EnumCheck<AddressFamily,
       AddressFamily::Any,
       AddressFamily::IPv4,
-      AddressFamily::IPv6>;
+      AddressFamily::IPv6,
+      AddressFamily::Unix>;
 
 enum class SocketType : uint32_t {
     Any         = 0,
     Datagram    = SOCK_DGRAM,
     Stream      = SOCK_STREAM,
     Raw         = SOCK_RAW,
+    SeqPacket   = SOCK_SEQPACKET,   // AF_UNIX: connected, reliable, keeps message boundaries
 };
 using SocketTypeCheck = cpp::EnumCheck<SocketType,
       SocketType::Any,
       SocketType::Datagram,
       SocketType::Stream,
-      SocketType::Raw>;
+      SocketType::Raw,
+      SocketType::SeqPacket>;
+
+// OR'ed into the socket type on creation (socket(), accept4()), so the flags are
+// in effect atomically, without a separate fcntl().
+enum class SocketFlag : uint32_t {
+    NonBlock    = SOCK_NONBLOCK,
+    CloseOnExec = SOCK_CLOEXEC,
+};
+using SocketFlagCheck = cpp::EnumCheck<SocketFlag,
+      SocketFlag::NonBlock,
+      SocketFlag::CloseOnExec>;
 
 enum class Protocol : uint32_t {
     Any = 0,
@@ -72,10 +91,17 @@ using AIFlagCheck = cpp::EnumCheck<AIFlag,
 	AIFlag::AddrConfig>;
 
 enum class RecvFlag : uint32_t {
-    DontWait = MSG_DONTWAIT,
+    DontWait        = MSG_DONTWAIT,
+    WaitForOne      = MSG_WAITFORONE,   // recvmmsg() only
+    ErrQueue        = MSG_ERRQUEUE,
+    CmsgCloseOnExec = MSG_CMSG_CLOEXEC, // descriptors received with SCM_RIGHTS get FD_CLOEXEC
     // TODO: augment me plz
 };
-using RecvFlagCheck = cpp::EnumCheck<RecvFlag, RecvFlag::DontWait>;
+using RecvFlagCheck = cpp::EnumCheck<RecvFlag,
+      RecvFlag::DontWait,
+      RecvFlag::WaitForOne,
+      RecvFlag::ErrQueue,
+      RecvFlag::CmsgCloseOnExec>;
 
 enum class SendFlag : uint32_t {
     Confirm     = MSG_CONFIRM,
@@ -85,6 +111,7 @@ enum class SendFlag : uint32_t {
     More        = MSG_MORE,
     NoSignal    = MSG_NOSIGNAL,
     OutOfBounds = MSG_OOB,
+    ZeroCopy    = MSG_ZEROCOPY,     // see Socket::send_zerocopy()
 };
 using SendFlagCheck = cpp::EnumCheck<SendFlag,
       SendFlag::Confirm,
@@ -93,14 +120,78 @@ using SendFlagCheck = cpp::EnumCheck<SendFlag,
       SendFlag::EndOfRecord,
       SendFlag::More,
       SendFlag::NoSignal,
-      SendFlag::OutOfBounds>;
+      SendFlag::OutOfBounds,
+      SendFlag::ZeroCopy>;
+
+// Flags reported back by the kernel in msghdr.msg_flags (recvmsg/recvmmsg).
+// These are not input flags, so they get their own type.
+enum class MsgFlag : uint32_t {
+    Truncated        = MSG_TRUNC,
+    ControlTruncated = MSG_CTRUNC,
+    EndOfRecord      = MSG_EOR,
+    OutOfBounds      = MSG_OOB,
+    ErrQueue         = MSG_ERRQUEUE,
+};
+using MsgFlagCheck = cpp::EnumCheck<MsgFlag,
+      MsgFlag::Truncated,
+      MsgFlag::ControlTruncated,
+      MsgFlag::EndOfRecord,
+      MsgFlag::OutOfBounds,
+      MsgFlag::ErrQueue>;
+
+// What the kernel should timestamp, and how to report it (SO_TIMESTAMPING, see
+// Socket::set_timestamping()). Generation flags pick the events, reporting flags
+// pick which of them end up in control messages.
+enum class TimestampFlag : uint32_t {
+    TxHardware  = SOF_TIMESTAMPING_TX_HARDWARE,     // generate: NIC transmit
+    TxSoftware  = SOF_TIMESTAMPING_TX_SOFTWARE,     // generate: handed to the driver
+    TxSched     = SOF_TIMESTAMPING_TX_SCHED,        // generate: entering the packet scheduler
+    TxAck       = SOF_TIMESTAMPING_TX_ACK,          // generate: acknowledged by the peer (TCP)
+    RxHardware  = SOF_TIMESTAMPING_RX_HARDWARE,     // generate: NIC receive
+    RxSoftware  = SOF_TIMESTAMPING_RX_SOFTWARE,     // generate: entering the stack
+    Software    = SOF_TIMESTAMPING_SOFTWARE,        // report software timestamps
+    RawHardware = SOF_TIMESTAMPING_RAW_HARDWARE,    // report hardware timestamps
+    OptId       = SOF_TIMESTAMPING_OPT_ID,          // number TX timestamps per send (TxTimestamp::id)
+    OptTsOnly   = SOF_TIMESTAMPING_OPT_TSONLY,      // TX timestamps without a copy of the packet
+};
+using TimestampFlagCheck = cpp::EnumCheck<TimestampFlag,
+      TimestampFlag::TxHardware,
+      TimestampFlag::TxSoftware,
+      TimestampFlag::TxSched,
+      TimestampFlag::TxAck,
+      TimestampFlag::RxHardware,
+      TimestampFlag::RxSoftware,
+      TimestampFlag::Software,
+      TimestampFlag::RawHardware,
+      TimestampFlag::OptId,
+      TimestampFlag::OptTsOnly>;
+
+// Which event a TX timestamp from the error queue records
+enum class TxStamp : uint32_t {
+    Sent      = SCM_TSTAMP_SND,     // passed to the driver (or the NIC, for hardware stamps)
+    Scheduled = SCM_TSTAMP_SCHED,   // entered the packet scheduler
+    Acked     = SCM_TSTAMP_ACK,     // acknowledged by the peer (TCP)
+};
+using TxStampCheck = cpp::EnumCheck<TxStamp,
+      TxStamp::Sent,
+      TxStamp::Scheduled,
+      TxStamp::Acked>;
+
+// Flag sets are a single integer, and brace lists of flags fold at compile time
+static_assert(sizeof(Flags<SendFlag>) == sizeof(uint32_t), "Flags<SendFlag> should be a plain uint32_t");
+static_assert(Flags<SendFlag>{SendFlag::More, SendFlag::NoSignal}.value() == (MSG_MORE | MSG_NOSIGNAL),
+              "Flags should be a compile time constant");
 
 inline auto to_integral(AddressFamily af)   { return _to_integral<AddressFamilyCheck>(af);  }
 inline auto to_integral(SocketType st)      { return _to_integral<SocketTypeCheck>(st);     }
+inline auto to_integral(SocketFlag sf)      { return _to_integral<SocketFlagCheck>(sf);     }
 inline auto to_integral(Protocol pt)        { return _to_integral<ProtocolCheck>(pt);       }
 inline auto to_integral(AIFlag fl)          { return _to_integral<AIFlagCheck>(fl);         }
 inline auto to_integral(RecvFlag rfl)       { return _to_integral<RecvFlagCheck>(rfl);      }
 inline auto to_integral(SendFlag sfl)       { return _to_integral<SendFlagCheck>(sfl);      }
+inline auto to_integral(MsgFlag mfl)        { return _to_integral<MsgFlagCheck>(mfl);       }
+inline auto to_integral(TimestampFlag tfl)  { return _to_integral<TimestampFlagCheck>(tfl); }
+inline auto to_integral(TxStamp ts)         { return _to_integral<TxStampCheck>(ts);        }
 
 template <typename T>
 inline auto to_enum(int);
@@ -110,6 +201,8 @@ inline auto to_enum<AddressFamily>(int v)   { return _to_enum<AddressFamilyCheck
 template <>
 inline auto to_enum<SocketType>(int v)      { return _to_enum<SocketTypeCheck, SocketType>(v);       }
 template <>
+inline auto to_enum<SocketFlag>(int v)      { return _to_enum<SocketFlagCheck, SocketFlag>(v);       }
+template <>
 inline auto to_enum<Protocol>(int v)        { return _to_enum<ProtocolCheck, Protocol>(v);           }
 template <>
 inline auto to_enum<AIFlag>(int v)          { return _to_enum<AIFlagCheck, AIFlag>(v);               }
@@ -117,90 +210,138 @@ template <>
 inline auto to_enum<RecvFlag>(int v)        { return _to_enum<RecvFlagCheck, RecvFlag>(v);           }
 template <>
 inline auto to_enum<SendFlag>(int v)        { return _to_enum<SendFlagCheck, SendFlag>(v);           }
+template <>
+inline auto to_enum<MsgFlag>(int v)         { return _to_enum<MsgFlagCheck, MsgFlag>(v);             }
+template <>
+inline auto to_enum<TimestampFlag>(int v)   { return _to_enum<TimestampFlagCheck, TimestampFlag>(v); }
+template <>
+inline auto to_enum<TxStamp>(int v)         { return _to_enum<TxStampCheck, TxStamp>(v);             }
 
 
-static inline Maybe<std::string> enum_name(AddressFamily af){
-    using s = std::string;
-    switch(af){
-        case AddressFamily::Any:  return s("Protocol::Any");
-        case AddressFamily::IPv4: return s("AddressFamily::IPv4");
-        case AddressFamily::IPv6: return s("AddressFamily::IPv6");
-    }
-    return Nothing();
-}
-static inline Maybe<std::string> enum_name(SocketType t){
-    using s = std::string;
-    switch(t){
-        case SocketType::Any:       return s("SocketType::Any");
-        case SocketType::Datagram:  return s("SocketType::Datagram");
-        case SocketType::Stream:    return s("SocketType::Stream");
-        case SocketType::Raw:       return s("SocketType::Raw");
-    }
-    return Nothing();
-}
-static inline Maybe<std::string> enum_name(Protocol pt){
-    using s = std::string;
-    switch(pt){
-        case Protocol::Any: return s("Protocol::Any");
-        case Protocol::UDP: return s("Protocol::UDP");
-        case Protocol::TCP: return s("Protocol::TCP");
-    }
-    return Nothing();
-}
-static inline const Maybe<std::string> enum_name(AIFlag f){
-    using s = std::string;
-    switch(f){
-        case AIFlag::Passive:       return s("AIFlag::Passive");
-        case AIFlag::CanonName:     return s("AIFlag::CanonName");
-        case AIFlag::NumericHost:   return s("AIFlag::NumericHost");
-        case AIFlag::NumericServ:   return s("AIFlag::NumericServ");
-        case AIFlag::V4Mapped:      return s("AIFlag::V4Mapped");
-        case AIFlag::All:           return s("AIFlag::All");
-        case AIFlag::AddrConfig:    return s("AIFlag::AddrConfig");
-        break;
-    }
-    return Nothing();
-}
-static inline Maybe<std::string> enum_name(RecvFlag f){
-    using s = std::string;
-    switch(f){
-        case RecvFlag::DontWait: return s("RecvFlag::DontWait");
-        // TODO: augment me, plz
-    }
-    return Nothing();
-}
+constexpr auto address_family_names = cpp::make_enum_table<AddressFamily>({
+    {AddressFamily::Any,  "AddressFamily::Any"},
+    {AddressFamily::IPv4, "AddressFamily::IPv4"},
+    {AddressFamily::IPv6, "AddressFamily::IPv6"},
+    {AddressFamily::Unix, "AddressFamily::Unix"},
+});
+static inline Maybe<StringView> enum_name(AddressFamily v) { return address_family_names.name(v); }
 
-static inline Maybe<std::string> enum_name(SendFlag f){
-    using s = std::string;
-    switch(f){
-        case SendFlag::Confirm:     return s("SendFlag::Confirm");
-        case SendFlag::DontWait:    return s("SendFlag::DontWait");
-        case SendFlag::DontRoute:   return s("SendFlag::DontRoute");
-        case SendFlag::EndOfRecord: return s("SendFlag::EndOfRecord");
-        case SendFlag::More:        return s("SendFlag::More");
-        case SendFlag::NoSignal:    return s("SendFlag::NoSignal");
-        case SendFlag::OutOfBounds: return s("SendFlag::OutOfBounds");
-        break;
-    }
-    return Nothing();
-}
+constexpr auto socket_type_names = cpp::make_enum_table<SocketType>({
+    {SocketType::Any,       "SocketType::Any"},
+    {SocketType::Datagram,  "SocketType::Datagram"},
+    {SocketType::Stream,    "SocketType::Stream"},
+    {SocketType::Raw,       "SocketType::Raw"},
+    {SocketType::SeqPacket, "SocketType::SeqPacket"},
+});
+static inline Maybe<StringView> enum_name(SocketType v) { return socket_type_names.name(v); }
+
+constexpr auto socket_flag_names = cpp::make_enum_table<SocketFlag>({
+    {SocketFlag::NonBlock,    "SocketFlag::NonBlock"},
+    {SocketFlag::CloseOnExec, "SocketFlag::CloseOnExec"},
+});
+static inline Maybe<StringView> enum_name(SocketFlag v) { return socket_flag_names.name(v); }
+
+constexpr auto protocol_names = cpp::make_enum_table<Protocol>({
+    {Protocol::Any, "Protocol::Any"},
+    {Protocol::UDP, "Protocol::UDP"},
+    {Protocol::TCP, "Protocol::TCP"},
+});
+static inline Maybe<StringView> enum_name(Protocol v) { return protocol_names.name(v); }
 
-inline std::string to_string(AddressFamily v)  { return enum_name(v).value_or("<Unknown AddressFamily: " + std::to_string(cpp::to_underlying(v)) + ">"); }
-inline std::string to_string(SocketType v)     { return enum_name(v).value_or("<Unknown SocketType: "    + std::to_string(cpp::to_underlying(v)) + ">"); }
-inline std::string to_string(Protocol v)       { return enum_name(v).value_or("<Unknown Protocol: "      + std::to_string(cpp::to_underlying(v)) + ">"); }
-inline std::string to_string(RecvFlag v)       { return enum_name(v).value_or("<Unknown RecvFlag: "      + std::to_string(cpp::to_underlying(v)) + ">"); }
-inline std::string to_string(SendFlag v)       { return enum_name(v).value_or("<Unknown SendFlag: "      + std::to_string(cpp::to_underlying(v)) + ">"); }
-inline std::string to_string(const std::vector<AIFlag> & vf){
+constexpr auto ai_flag_names = cpp::make_enum_table<AIFlag>({
+    {AIFlag::Passive,     "AIFlag::Passive"},
+    {AIFlag::CanonName,   "AIFlag::CanonName"},
+    {AIFlag::NumericHost, "AIFlag::NumericHost"},
+    {AIFlag::NumericServ, "AIFlag::NumericServ"},
+    {AIFlag::V4Mapped,    "AIFlag::V4Mapped"},
+    {AIFlag::All,         "AIFlag::All"},
+    {AIFlag::AddrConfig,  "AIFlag::AddrConfig"},
+});
+static inline Maybe<StringView> enum_name(AIFlag v) { return ai_flag_names.name(v); }
+
+constexpr auto recv_flag_names = cpp::make_enum_table<RecvFlag>({
+    {RecvFlag::DontWait,        "RecvFlag::DontWait"},
+    {RecvFlag::WaitForOne,      "RecvFlag::WaitForOne"},
+    {RecvFlag::ErrQueue,        "RecvFlag::ErrQueue"},
+    {RecvFlag::CmsgCloseOnExec, "RecvFlag::CmsgCloseOnExec"},
+});
+static inline Maybe<StringView> enum_name(RecvFlag v) { return recv_flag_names.name(v); }
+
+constexpr auto send_flag_names = cpp::make_enum_table<SendFlag>({
+    {SendFlag::Confirm,     "SendFlag::Confirm"},
+    {SendFlag::DontWait,    "SendFlag::DontWait"},
+    {SendFlag::DontRoute,   "SendFlag::DontRoute"},
+    {SendFlag::EndOfRecord, "SendFlag::EndOfRecord"},
+    {SendFlag::More,        "SendFlag::More"},
+    {SendFlag::NoSignal,    "SendFlag::NoSignal"},
+    {SendFlag::OutOfBounds, "SendFlag::OutOfBounds"},
+    {SendFlag::ZeroCopy,    "SendFlag::ZeroCopy"},
+});
+static inline Maybe<StringView> enum_name(SendFlag v) { return send_flag_names.name(v); }
+
+constexpr auto msg_flag_names = cpp::make_enum_table<MsgFlag>({
+    {MsgFlag::Truncated,        "MsgFlag::Truncated"},
+    {MsgFlag::ControlTruncated, "MsgFlag::ControlTruncated"},
+    {MsgFlag::EndOfRecord,      "MsgFlag::EndOfRecord"},
+    {MsgFlag::OutOfBounds,      "MsgFlag::OutOfBounds"},
+    {MsgFlag::ErrQueue,         "MsgFlag::ErrQueue"},
+});
+static inline Maybe<StringView> enum_name(MsgFlag v) { return msg_flag_names.name(v); }
+
+constexpr auto timestamp_flag_names = cpp::make_enum_table<TimestampFlag>({
+    {TimestampFlag::TxHardware,  "TimestampFlag::TxHardware"},
+    {TimestampFlag::TxSoftware,  "TimestampFlag::TxSoftware"},
+    {TimestampFlag::TxSched,     "TimestampFlag::TxSched"},
+    {TimestampFlag::TxAck,       "TimestampFlag::TxAck"},
+    {TimestampFlag::RxHardware,  "TimestampFlag::RxHardware"},
+    {TimestampFlag::RxSoftware,  "TimestampFlag::RxSoftware"},
+    {TimestampFlag::Software,    "TimestampFlag::Software"},
+    {TimestampFlag::RawHardware, "TimestampFlag::RawHardware"},
+    {TimestampFlag::OptId,       "TimestampFlag::OptId"},
+    {TimestampFlag::OptTsOnly,   "TimestampFlag::OptTsOnly"},
+});
+static inline Maybe<StringView> enum_name(TimestampFlag v) { return timestamp_flag_names.name(v); }
+
+constexpr auto tx_stamp_names = cpp::make_enum_table<TxStamp>({
+    {TxStamp::Sent,      "TxStamp::Sent"},
+    {TxStamp::Scheduled, "TxStamp::Scheduled"},
+    {TxStamp::Acked,     "TxStamp::Acked"},
+});
+static inline Maybe<StringView> enum_name(TxStamp v) { return tx_stamp_names.name(v); }
+
+inline std::string to_string(AddressFamily v)  { return cpp::enum_to_string(enum_name(v), "AddressFamily", v); }
+inline std::string to_string(SocketType v)     { return cpp::enum_to_string(enum_name(v), "SocketType",    v); }
+inline std::string to_string(SocketFlag v)     { return cpp::enum_to_string(enum_name(v), "SocketFlag",    v); }
+inline std::string to_string(Protocol v)       { return cpp::enum_to_string(enum_name(v), "Protocol",      v); }
+inline std::string to_string(RecvFlag v)       { return cpp::enum_to_string(enum_name(v), "RecvFlag",      v); }
+inline std::string to_string(SendFlag v)       { return cpp::enum_to_string(enum_name(v), "SendFlag",      v); }
+inline std::string to_string(MsgFlag v)        { return cpp::enum_to_string(enum_name(v), "MsgFlag",       v); }
+inline std::string to_string(TimestampFlag v)  { return cpp::enum_to_string(enum_name(v), "TimestampFlag", v); }
+inline std::string to_string(TxStamp v)        { return cpp::enum_to_string(enum_name(v), "TxStamp",       v); }
+inline std::string to_string(Flags<AIFlag> fl){
     std::stringstream ss;
     ss << "[";
-    for(size_t i = 0; i < vf.size(); ++i){
-        if(i > 0){ ss << ", "; }
-        ss << enum_name(vf[i]).value_or("Unknown AIFlag: " + std::to_string(cpp::to_underlying(vf[i])));
+    bool first = true;
+    for(auto f : fl){
+        if(!first){ ss << ", "; }
+        first = false;
+        auto n = enum_name(f);
+        if(n){ ss << *n; } else { ss << "Unknown AIFlag: " << cpp::to_underlying(f); }
     }
     ss << "]";
     return ss.str();
 }
 
+// Streams the name of any of the enums above without building a string
+template <typename E, typename = decltype(enum_name(std::declval<E>()))>
+inline std::ostream & operator<<(std::ostream & os, E v){
+    auto n = enum_name(v);
+    if(n){
+        return os << *n;
+    }
+    return os << "<Unknown: " << cpp::to_underlying(v) << ">";
+}
+
 } // ns inet
 
 } // ns unix
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <streambuf>
+#include <ostream>
+#include <cstddef>
+#include <cstdint>
+
+// Diagnostics for the library (and whoever else wants them).
+//
+// The level is chosen at compile time with UNIXBURRITO_LOG_LEVEL (0 = Debug, 1 = Info,
+// 2 = Warning, 3 = Error, 4 = Off; CMake option of the same name). Statements below
+// that level compile to nothing, including the evaluation of their arguments:
+//
+//   UB_DEBUG("epoll created: " << fd);
+//
+// Enabled statements are formatted into a stack buffer (no allocation) and pushed
+// into a lock-free ring owned by the calling thread. A background thread drains the
+// rings into stderr, so logging never blocks on I/O; it sleeps while there is
+// nothing to write. If a ring is full, the message is dropped and counted.
+// Messages longer than Record::max_len are truncated.
+
+#ifndef UNIXBURRITO_LOG_LEVEL
+#define UNIXBURRITO_LOG_LEVEL 1
+#endif
+
+namespace _unix {
+
+namespace log {
+
+enum class Level : int {
+    Debug   = 0,
+    Info    = 1,
+    Warning = 2,
+    Error   = 3,
+    Off     = 4,
+};
+
+constexpr Level compiled_level = static_cast<Level>(UNIXBURRITO_LOG_LEVEL);
+
+constexpr bool enabled(Level l){
+    return static_cast<int>(l) >= static_cast<int>(compiled_level)
+        && l != Level::Off;
+}
+
+const char * level_name(Level l);
+
+// Wait until everything logged so far (by any thread) has been written out
+void flush();
+
+// One log statement. Use through the UB_* macros.
+class Record {
+public:
+    static constexpr size_t max_len = 480;
+
+    explicit Record(Level l) : _level(l), _buf(_text, sizeof(_text)), _os(&_buf) {}
+    ~Record();
+
+    Record(const Record &)            = delete;
+    Record& operator=(const Record &) = delete;
+
+    std::ostream & stream() { return _os; }
+
+private:
+    // Writes into a fixed array; overflowing output is silently cut off
+    class FixedBuf : public std::streambuf {
+    public:
+        FixedBuf(char * p, size_t n) { setp(p, p + n); }
+        size_t size() const { return pptr() - pbase(); }
+        bool   full() const { return pptr() == epptr(); }
+    };
+
+    Level        _level;
+    char         _text[max_len];
+    FixedBuf     _buf;
+    std::ostream _os;
+};
+
+} // ns log
+
+} // ns _unix
+
+#define UB_LOG(lvl, expr)                                                       \
+    do {                                                                        \
+        if(::_unix::log::enabled(::_unix::log::Level::lvl)){                    \
+            ::_unix::log::Record _ub_log_rec(::_unix::log::Level::lvl);         \
+            _ub_log_rec.stream() << expr;                                       \
+        }                                                                       \
+    } while(0)
+
+#define UB_DEBUG(expr)  UB_LOG(Debug, expr)
+#define UB_INFO(expr)   UB_LOG(Info, expr)
+#define UB_WARN(expr)   UB_LOG(Warning, expr)
+#define UB_ERROR(expr)  UB_LOG(Error, expr)
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <stdexcept>
+#include <string>
+
+#include <cpp.hpp>
+#include <unix/common.hpp>
+
+namespace _unix {
+
+enum class PipeFlag {
+    CloseOnExec = O_CLOEXEC,
+    NonBlock    = O_NONBLOCK,
+    Direct      = O_DIRECT,     // "packet" mode, each write() is a separate read()
+};
+
+enum class SpliceFlag : uint32_t {
+    Move     = SPLICE_F_MOVE,       // hint: move pages instead of copying
+    NonBlock = SPLICE_F_NONBLOCK,   // do not block on the pipe (the other fd has its own mode)
+    More     = SPLICE_F_MORE,       // more data follows, like SendFlag::More
+    Gift     = SPLICE_F_GIFT,       // vmsplice() only
+};
+using SpliceFlagCheck = cpp::EnumCheck<SpliceFlag,
+      SpliceFlag::Move,
+      SpliceFlag::NonBlock,
+      SpliceFlag::More,
+      SpliceFlag::Gift>;
+
+constexpr auto splice_flag_names = cpp::make_enum_table<SpliceFlag>({
+    {SpliceFlag::Move,     "SpliceFlag::Move"},
+    {SpliceFlag::NonBlock, "SpliceFlag::NonBlock"},
+    {SpliceFlag::More,     "SpliceFlag::More"},
+    {SpliceFlag::Gift,     "SpliceFlag::Gift"},
+});
+static inline cpp::Maybe<cpp::StringView> enum_name(SpliceFlag v) { return splice_flag_names.name(v); }
+inline std::string to_string(SpliceFlag v) { return cpp::enum_to_string(enum_name(v), "SpliceFlag", v); }
+
+// Outcome of a loop that moves data until done or until it cannot continue
+// (Socket::sendfile_all(), Socket::splice_all()).
+struct Transfer {
+    size_t bytes = 0;       // moved in total by this call
+    bool   again = false;   // stopped on EAGAIN: wait for readiness, then call again
+    bool   eof   = false;   // the source had no more data
+    int    error = 0;       // errno of a failure, 0 if none
+
+    bool ok() const { return error == 0; }
+};
+
+// Kernel pipe, mainly as the in-kernel buffer for splice(): file -> pipe -> socket
+// moves data without it ever being copied to userspace.
+class Pipe {
+public:
+    Pipe(cpp::Flags<PipeFlag> fl = {PipeFlag::CloseOnExec}){
+        int fds[2];
+        if(::pipe2(fds, cpp::to_int(fl)) != 0){
+            throw std::runtime_error("pipe2(): " + _unix::errno_str(errno));
+        }
+        _r = fds[0];
+        _w = fds[1];
+    }
+    ~Pipe(){
+        if(_r >= 0){ ::close(_r); }
+        if(_w >= 0){ ::close(_w); }
+        _r = _w = -1;
+    }
+
+    // RO3
+    Pipe(const Pipe &)            = delete;
+    Pipe& operator=(const Pipe &) = delete;
+    Pipe(Pipe && o) : _r(o._r), _w(o._w) { o._r = o._w = -1; }
+    Pipe& operator=(Pipe && o) { std::swap(_r, o._r); std::swap(_w, o._w); return *this; }
+
+    // Capacity in bytes (F_GETPIPE_SZ / F_SETPIPE_SZ). A larger pipe means fewer
+    // splice() calls per transfer. Returns the capacity, or -1 and errno.
+    int capacity() const  { return ::fcntl(_w, F_GETPIPE_SZ); }
+    int set_capacity(int bytes) { return ::fcntl(_w, F_SETPIPE_SZ, bytes); }
+
+    // Bytes currently buffered (FIONREAD), or -1 and errno
+    int size() const {
+        int n = 0;
+        return (::ioctl(_r, FIONREAD, &n) == 0) ? n : -1;
+    }
+
+    // Fill the pipe from file 'fd' starting at 'offset', which is advanced. Returns
+    // bytes moved, 0 at end of file, or -1 and errno.
+    ssize_t splice_from(int fd, off_t & offset, size_t len, cpp::Flags<SpliceFlag> fl = {SpliceFlag::Move}){
+        loff_t off = offset;
+        auto ret = ::splice(fd, &off, _w, nullptr, len, cpp::to_int(fl));
+        offset = off;
+        return ret;
+    }
+    // Fill the pipe from a socket or another pipe (no offset)
+    ssize_t splice_from(int fd, size_t len, cpp::Flags<SpliceFlag> fl = {SpliceFlag::Move}){
+        return ::splice(fd, nullptr, _w, nullptr, len, cpp::to_int(fl));
+    }
+    // Drain the pipe into 'fd' (socket, pipe, or file without offset)
+    ssize_t splice_to(int fd, size_t len, cpp::Flags<SpliceFlag> fl = {SpliceFlag::Move}){
+        return ::splice(_r, nullptr, fd, nullptr, len, cpp::to_int(fl));
+    }
+
+    // Duplicate up to 'len' bytes into 'out' without consuming them from this pipe.
+    // Returns bytes duplicated, 0 if this pipe is empty and has no writers, or -1
+    // and errno.
+    ssize_t tee(Pipe & out, size_t len, cpp::Flags<SpliceFlag> fl = {}){
+        return ::tee(_r, out._w, len, cpp::to_int(fl));
+    }
+
+    int read_fd()  const { return _r; }
+    int write_fd() const { return _w; }
+private:
+    int _r;
+    int _w;
+};
+
+} // ns _unix
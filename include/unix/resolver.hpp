@@ -0,0 +1,123 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <unix/inet.hpp>
+#include <unix/epoll.hpp>
+#include <unix/eventfd.hpp>
+
+namespace _unix {
+
+namespace inet {
+
+// Outcome of a Resolver lookup
+struct Resolution {
+    int                   error;    // 0, or an EAI_* code (see error_str())
+    std::vector<AddrInfo> addrs;
+
+    bool ok() const { return error == 0; }
+    std::string error_str() const { return ::gai_strerror(error); }
+};
+
+// Non-blocking replacement for getAddrInfo(). The blocking getaddrinfo() calls run in
+// worker threads, and finished lookups are signalled through an eventfd, so the
+// Resolver can be registered to an EventLoop like any other handler:
+//
+//   loop.add(resolver.__fd(), resolver, {EpollEventType::Input});
+//
+// (or poll __fd() yourself and call process()). Callbacks always run in the thread
+// calling process() or resolve(), never in the workers.
+//
+// Successful results are cached for 'ttl', keyed by host, service and hints. A cache
+// hit is a hash lookup, without syscalls. getaddrinfo() does not expose DNS TTLs,
+// so the same TTL applies to all entries. At most 'max_entries' are kept: adding one
+// first drops the expired entries, then the oldest ones. Concurrent lookups for the
+// same key are merged into one.
+class Resolver : public _unix::epoll::EventHandler {
+public:
+    using Callback = std::function<void(const Resolution &)>;
+    using Seconds  = std::chrono::seconds;
+
+    Resolver(Seconds ttl = Seconds(60), size_t workers = 1, size_t max_entries = 4096);
+    ~Resolver();
+
+    // RO3
+    Resolver(const Resolver &)            = delete;
+    Resolver& operator=(const Resolver &) = delete;
+
+    // Start a lookup. If the answer is cached, 'cb' is called immediately and the
+    // return value is true. Otherwise 'cb' is called later from process().
+    bool resolve(const std::string & host, const AddrInfo & hints,
+                 const std::string & service, Callback cb);
+
+    // Cache lookup only
+    Maybe<std::vector<AddrInfo>> cached(const std::string & host, const AddrInfo & hints,
+                                        const std::string & service);
+
+    // Run callbacks of all finished lookups. Returns how many lookups finished.
+    size_t process();
+
+    void on_event(const _unix::epoll::EpollEvent &) override { process(); }
+
+    // Lookups started but not yet processed
+    size_t pending() const { return _inflight.size(); }
+
+    void clear_cache() { _cache.clear(); _order.clear(); }
+
+    int __fd() const { return _done_fd.__fd(); }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Request {
+        std::string     key;
+        std::string     host;
+        std::string     service;
+        struct addrinfo hints;
+    };
+    struct Done {
+        std::string key;
+        Resolution  res;
+    };
+    struct Entry {
+        Clock::time_point     expires;
+        std::vector<AddrInfo> addrs;
+    };
+
+    static std::string _key(const std::string & host, const AddrInfo & hints,
+                            const std::string & service);
+    void _work();
+    void _insert(const std::string & key, const std::vector<AddrInfo> & addrs);
+
+    Clock::duration _ttl;
+    size_t          _max_entries;
+
+    // Loop thread only
+    std::unordered_map<std::string, Entry>                 _cache;
+    // Keys in insertion order, which is also expiry order as the TTL is the same for
+    // all. Entries erased or replaced since leave stale items, skipped on the way.
+    std::deque<std::pair<Clock::time_point, std::string>>  _order;
+    std::unordered_map<std::string, std::vector<Callback>> _inflight;
+
+    // Shared with the workers
+    std::mutex              _lock;
+    std::condition_variable _cv;
+    std::deque<Request>     _requests;
+    std::vector<Done>       _done;
+    bool                    _quit;
+
+    _unix::EventFd           _done_fd;
+    std::vector<std::thread> _workers;
+};
+
+} // ns inet
+
+} // ns _unix
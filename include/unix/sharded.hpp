@@ -0,0 +1,78 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unix/inet.hpp>
+#include <unix/epoll.hpp>
+
+namespace _unix {
+
+namespace inet {
+
+// N UDP sockets bound to the same address with SO_REUSEPORT, each served by its own
+// thread and EventLoop. The kernel hashes incoming flows across the sockets, so
+// packets of one flow always land on the same shard.
+//
+// The shard threads block all signals, so the usual handleInterrupt() setup in the
+// main thread keeps working: catch the signal there and call stop().
+class ShardedUdpServer {
+public:
+    // Called in the shard's thread when the socket becomes readable. The socket is
+    // non-blocking and registered edge triggered: read until EAGAIN.
+    using Handler = std::function<void(Socket &, size_t shard)>;
+
+    // 'shards' == 0 means one per online CPU. With 'pin_cpus', shard i runs on CPU i
+    // (modulo the CPU count). Throws std::runtime_error if the sockets cannot be set up.
+    ShardedUdpServer(
+        const std::string & laddr,
+        const std::string & service,
+        Handler handler,
+        size_t shards = 0,
+        bool pin_cpus = false
+    );
+    ~ShardedUdpServer();
+
+    // RO3
+    ShardedUdpServer(const ShardedUdpServer &)            = delete;
+    ShardedUdpServer& operator=(const ShardedUdpServer &) = delete;
+
+    void start();
+
+    // Wakes up all shards and waits for their threads to finish. Safe to call
+    // more than once, but not from a signal handler.
+    void stop();
+
+    size_t size() const { return _shards.size(); }
+    Socket & socket(size_t shard) { return _shards.at(shard)->sock; }
+
+    // Run 't' in the thread of 'shard' (once started). Safe from any thread.
+    int post(size_t shard, _unix::epoll::TaskQueue::Task t){
+        return _shards.at(shard)->tasks.post(std::move(t));
+    }
+
+private:
+    struct Shard : public _unix::epoll::EventHandler {
+        Shard(Socket && s, size_t i, ShardedUdpServer & srv);
+        void on_event(const _unix::epoll::EpollEvent & ev) override;
+        void run();
+
+        Socket                        sock;
+        size_t                        index;
+        ShardedUdpServer &            server;
+        _unix::epoll::TaskQueue       tasks;
+        _unix::epoll::EventLoop<64>   loop;
+        std::thread                   thread;
+    };
+
+    Handler                             _handler;
+    bool                                _pin;
+    std::vector<std::unique_ptr<Shard>> _shards;
+};
+
+} // ns inet
+
+} // ns _unix
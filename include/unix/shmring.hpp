@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <cpp.hpp>
+#include <unix/inet.hpp>
+#include <unix/bufpool.hpp>
+
+namespace _unix {
+
+// Single producer, single consumer message ring in shared memory, for the highest
+// rate paths between two processes (or threads) on the same host. Once set up, a
+// message costs two memcpy()s and no syscalls, as long as the consumer keeps up.
+//
+// Messages keep their boundaries, like datagrams, and send()/recv() mirror the
+// Socket ones, so code written against a UDP socket can switch over:
+//
+//   ShmRing ring(1 << 20);
+//   ring.send_to(unix_sock);                    // hand it to the peer (SCM_RIGHTS)
+//   ring.send(buf, len);
+//
+//   auto ring = ShmRing::receive_from(unix_sock);   // in the other process
+//   ring->recv(buf, sizeof(buf));
+//
+// The ring lives in a sealed memfd. Head, tail and the two sleep flags each have a
+// cache line of their own. Each side caches the other's index and reads it only
+// when the ring looks full or empty; the flags are read on every message but
+// written only around sleeping, so their lines stay shared. Blocking uses two
+// eventfd doorbells, rung only when the other side has announced it is about to
+// sleep:
+//
+//   - Consumer: register __fd() with Epoll for Input. On the event, recv() with
+//     RecvFlag::DontWait until it fails with EAGAIN, which re-arms the doorbell.
+//   - Producer: likewise with __space_fd() and send() when the ring was full.
+//
+// Without DontWait, recv() and send() sleep on the doorbell themselves, like a
+// blocking socket. A message larger than max_message() fails with EMSGSIZE.
+//
+// Exactly one thread may send and one may receive. Nothing tells when the peer has
+// gone away; pair the ring with the AF_UNIX socket it was passed over for that.
+class ShmRing {
+public:
+    static constexpr uint32_t magic   = 0x55425247;     // "UBRG"
+    static constexpr uint32_t version = 2;
+
+    // Creates a ring with room for 'capacity' bytes of messages (rounded up to a
+    // power of two, at least 4 KiB). Throws std::runtime_error if the memfd, the
+    // mapping or the eventfds cannot be created.
+    explicit ShmRing(size_t capacity = 1 << 20, const std::string & name = "unixburrito-ring");
+
+    // Maps a ring created by another process, from the descriptors sent with
+    // send_to() in the same order. Throws std::runtime_error if 'mem' is not a ring.
+    ShmRing(inet::ReceivedFd && mem, inet::ReceivedFd && data_bell, inet::ReceivedFd && space_bell);
+
+    ~ShmRing();
+
+    // RO3
+    ShmRing(const ShmRing &)            = delete;
+    ShmRing& operator=(const ShmRing &) = delete;
+    ShmRing(ShmRing && o);
+    ShmRing& operator=(ShmRing && o);
+
+    // Passes the ring over an AF_UNIX socket, with a one byte message. Returns the
+    // sendmsg() result.
+    ssize_t send_to(inet::Socket & via) const;
+    // Counterpart of send_to(). Nothing and errno (EBADMSG if what arrived was not a
+    // ring) on failure.
+    static cpp::Maybe<ShmRing> receive_from(inet::Socket & via);
+
+    // Bytes sent (always 'len'), or -1 and errno: EAGAIN if the ring is full and
+    // SendFlag::DontWait was given, EMSGSIZE if 'len' > max_message().
+    ssize_t send(const uint8_t * buf, size_t len, cpp::Flags<inet::SendFlag> fl = {});
+    ssize_t send(const PoolBuffer & b, cpp::Flags<inet::SendFlag> fl = {}){
+        return send(b.data(), b.size(), fl);
+    }
+    ssize_t send(const std::string & s, cpp::Flags<inet::SendFlag> fl = {}){
+        return send(reinterpret_cast<const uint8_t*>(s.data()), s.size(), fl);
+    }
+
+    // One message. Like recv() on a datagram socket, a message longer than 'buflen'
+    // is truncated and the rest of it is lost. Bytes received, or -1 and errno:
+    // EAGAIN if the ring is empty and RecvFlag::DontWait was given, EBADMSG if the
+    // peer wrote a record that does not fit the ring (which is then unusable).
+    ssize_t recv(uint8_t * buf, size_t buflen, cpp::Flags<inet::RecvFlag> fl = {});
+    ssize_t recv(PoolBuffer & b, cpp::Flags<inet::RecvFlag> fl = {})
+    {
+        auto ret = recv(b.data(), b.capacity(), fl);
+        b.set_size((ret > 0) ? ret : 0);
+        return ret;
+    }
+
+    size_t capacity()    const { return _cap; }
+    size_t max_message() const { return _cap / 2 - record_header; }
+
+    // Doorbells, readable when the consumer (__fd) or producer (__space_fd) should
+    // try again
+    int __fd()       const { return _data_bell; }
+    int __space_fd() const { return _space_bell; }
+
+private:
+    // Each message is an 8 byte header with its length, then the payload padded to 8
+    // bytes. A record that would not fit before the end of the ring is preceded
+    // by a wrap marker in place of a length.
+    static constexpr size_t   record_header = 8;
+    static constexpr uint32_t wrap_marker   = UINT32_MAX;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t capacity;
+        // Written by the producer
+        alignas(64) std::atomic<uint64_t> head;
+        alignas(64) std::atomic<uint32_t> space_waiting;    // producer is about to sleep on __space_fd()
+        // Written by the consumer
+        alignas(64) std::atomic<uint64_t> tail;
+        alignas(64) std::atomic<uint32_t> data_waiting;     // consumer is about to sleep on __fd()
+    };
+    static constexpr size_t data_offset = (sizeof(Header) + 63) & ~size_t(63);
+
+    static size_t _record(size_t len) { return record_header + ((len + 7) & ~size_t(7)); }
+
+    uint8_t * _data() const { return reinterpret_cast<uint8_t*>(_h) + data_offset; }
+
+    void _map(size_t bytes);
+    void _close();
+    // Sleep until 'bell' is rung
+    static int _wait(int bell);
+    // Announce that this side is about to sleep; 'waiting' is then set
+    static void _arm(std::atomic<uint32_t> & waiting, int bell);
+    static void _ring(std::atomic<uint32_t> & waiting, int bell);
+
+    int      _mem;
+    int      _data_bell;
+    int      _space_bell;
+    Header * _h;
+    size_t   _cap;
+    // Our copy of the other side's index, refreshed only when the ring looks full
+    // (producer) or empty (consumer)
+    uint64_t _cached_tail;
+    uint64_t _cached_head;
+};
+
+} // ns _unix
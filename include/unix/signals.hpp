@@ -1,12 +1,18 @@
 #pragma once
 
 #include <iostream>
-#include <map>
 #include <string>
 #include <csignal>
 #include <cstring>
+#include <stdexcept>
+#include <pthread.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#include <cpp.hpp>
 
 #include <unix/common.hpp>
+#include <unix/log.hpp>
 
 namespace _unix {
 
@@ -15,24 +21,29 @@ namespace signals {
 // TODO add more signals....
 enum class Signal : uint32_t {
     Interrupt = SIGINT,
+    Terminate = SIGTERM,
+    Hangup    = SIGHUP,
     User1     = SIGUSR1,
     User2     = SIGUSR2,
 };
 
 // TODO: Add more signals...
-const std::map<int, Signal> signal_map = {
-    {SIGINT,  Signal::Interrupt },
-    {SIGUSR1, Signal::User1     },
-    {SIGUSR2, Signal::User2     },
-};
+using SignalCheck = cpp::EnumCheck<Signal,
+      Signal::Interrupt,
+      Signal::Terminate,
+      Signal::Hangup,
+      Signal::User1,
+      Signal::User2>;
 
 // Contrary to other enum classes, it is best to keep the names of the signals as-is.
 // They are widely known as-is, and all cli programs use them as well.
-const std::map<Signal, std::string> signal_names = {
+constexpr auto signal_names = cpp::make_enum_table<Signal>({
     {Signal::Interrupt, "SIGINT"},
+    {Signal::Terminate, "SIGTERM"},
+    {Signal::Hangup,    "SIGHUP"},
     {Signal::User1,     "SIGUSR1"},
     {Signal::User2,     "SIGUSR2"},
-};
+});
 
 // without : uint32_t the compile complains that some flags are out of range
 // of the underlying type (int)
@@ -46,17 +57,7 @@ enum class SigActionFlag : uint32_t {
     IncludeSigInfo  = SA_SIGINFO,
     //SA_RESTORER,
 };
-const std::map<int, SigActionFlag> sigaction_map = {
-    {SA_NOCLDSTOP, SigActionFlag::NoChildStop      },
-    {SA_NOCLDWAIT, SigActionFlag::NoChildWait      },
-    {SA_NODEFER,   SigActionFlag::NoDefer          },
-    {SA_ONSTACK,   SigActionFlag::AlternateStack   },
-    {SA_RESETHAND, SigActionFlag::ResetHandler     },       // a.k.a SA_ONESHOT
-    {SA_RESTART,   SigActionFlag::RestartSysCall   },
-    {SA_SIGINFO,   SigActionFlag::IncludeSigInfo   },
-    //SA_RESTORER, Restorer},           // not intended for application usage
-};
-const std::map<SigActionFlag, std::string> sigaction_names = {
+constexpr auto sigaction_names = cpp::make_enum_table<SigActionFlag>({
     {SigActionFlag::NoChildStop,   "NoChildStop"    },
     {SigActionFlag::NoChildWait,   "NoChildWait"    },
     {SigActionFlag::NoDefer,       "NoDefer"        },
@@ -65,11 +66,38 @@ const std::map<SigActionFlag, std::string> sigaction_names = {
     {SigActionFlag::RestartSysCall,"RestartSysCall" },
     {SigActionFlag::IncludeSigInfo,"IncludeSigInfo" },
     //SA_RESTORER, Restorer},           // not intended for application usage
-};
+});
+
+static inline cpp::Maybe<cpp::StringView> enum_name(Signal s)        { return signal_names.name(s); }
+static inline cpp::Maybe<cpp::StringView> enum_name(SigActionFlag f) { return sigaction_names.name(f); }
 
 std::string to_string(Signal);
 std::string to_string(SigActionFlag);
 
+// A set of signals (sigset_t), e.g. a signal mask
+class SigSet {
+public:
+    SigSet(const std::initializer_list<Signal> & sigs = {}){
+        sigemptyset(&_set);
+        for(auto s : sigs){
+            add(s);
+        }
+    }
+    explicit SigSet(const sigset_t & set) : _set(set) {}
+    static SigSet full() { SigSet s; sigfillset(&s._set); return s; }
+
+    // Signal mask of the calling thread
+    static SigSet current() { SigSet s; ::pthread_sigmask(SIG_BLOCK, nullptr, &s._set); return s; }
+
+    SigSet & add(Signal s)    { sigaddset(&_set, cpp::to_underlying(s)); return *this; }
+    SigSet & remove(Signal s) { sigdelset(&_set, cpp::to_underlying(s)); return *this; }
+    bool contains(Signal s) const { return sigismember(&_set, cpp::to_underlying(s)) == 1; }
+
+    const sigset_t * get() const { return &_set; }
+private:
+    sigset_t _set;
+};
+
 // Fowrard declarations
 class SigAction;
 int sigaction(Signal signum, const SigAction & newact);
@@ -89,9 +117,11 @@ public:
     //     SigAction sa = SigAction::emptySet();
     //   or
     //     SigAction sa = SigAction::fullSet();
-    // TODO: These are not actually a feature of SigAction, but sigset_t. Create new class
-    static SigAction emptySet() { SigAction sa; sa._clear(); return sa; }
-    static SigAction fullSet()  { SigAction sa; sa._fill();  return sa; }
+    //   or, to block some signals while the handler runs
+    //     SigAction sa(SigSet{Signal::Hangup});
+    explicit SigAction(const SigSet & mask);
+    static SigAction emptySet() { return SigAction(SigSet()); }
+    static SigAction fullSet()  { return SigAction(SigSet::full()); }
 
 
     // The different handler types are mutually exclusive, but fortunately these
@@ -105,9 +135,13 @@ public:
     // Removes current handler (if exists), and assigns the ignore handler (SIG_IGN)
     void set_ignore_handler() { set_handler(SigAction::Ignore()); }
 
-    void mask_remove(Signal signum);
-    void mask_add(Signal signum);
-    bool mask_is_set(Signal signum) const;
+    // Signals blocked while the handler runs (sa_mask)
+    SigSet mask() const { return SigSet(_act.sa_mask); }
+    void set_mask(const SigSet & m) { _act.sa_mask = *m.get(); }
+
+    void mask_remove(Signal signum) { set_mask(mask().remove(signum)); }
+    void mask_add(Signal signum)    { set_mask(mask().add(signum)); }
+    bool mask_is_set(Signal signum) const { return mask().contains(signum); }
 
     std::string to_string(int level = 0) const;
 
@@ -115,14 +149,11 @@ public:
     // handled internally by set_handler() funcs. If you try, you will get a warning message into stderr.
     // Usage:
     //  set_flags({SigActionFlag::ResetHandler, ...});
-    void set_flags(const std::initializer_list<SigActionFlag> & fl);
+    void set_flags(cpp::Flags<SigActionFlag> fl);
 
     // access to the underlying object is required when calling ::sigaction
     const struct sigaction * action() const;
 private:
-    SigAction();
-    void _clear();
-    void _fill();
     void _set_siginfo(bool on);
 
     std::string _handler_name() const;
@@ -159,20 +190,128 @@ int handleInterrupt(H h) {
     SigAction sa = SigAction::emptySet();
     sa.set_handler(h);
 
-    std::cerr << sa.to_string() << "\n";
+    UB_DEBUG(sa.to_string());
 
     auto sig = Signal::Interrupt;
 
     // Set a signal handler to catch SIGINT to allow for graceful termination.
     if((_unix::signals::sigaction(sig, sa) != 0))
     {
-        std::cerr << "ERROR sigaction(): " << _unix::errno_str(errno) << "\n";
+        UB_ERROR("sigaction(): " << _unix::errno_str(errno));
         return -1;
     }
-    std::cerr << "INFO: signal handler set up for: " << _unix::signals::to_string(sig) << "\n";
+    UB_INFO("signal handler set up for: " << _unix::signals::to_string(sig));
     return 0;
 }
 
+// Block or unblock signals for the calling thread (pthread_sigmask). Threads created
+// afterwards inherit the mask. Returns 0 or -1 and errno.
+inline int _sigmask(int how, const std::initializer_list<Signal> & sigs){
+    SigSet set(sigs);
+    int ret = ::pthread_sigmask(how, set.get(), nullptr);
+    if(ret != 0){
+        errno = ret;
+        return -1;
+    }
+    return 0;
+}
+inline int block(const std::initializer_list<Signal> & sigs)   { return _sigmask(SIG_BLOCK, sigs); }
+inline int unblock(const std::initializer_list<Signal> & sigs) { return _sigmask(SIG_UNBLOCK, sigs); }
+
+enum class SignalFdFlag {
+    CloseOnExec = SFD_CLOEXEC,
+    NonBlock    = SFD_NONBLOCK,
+};
+
+// One signal read from a SignalFd (struct signalfd_siginfo)
+class SignalInfo {
+public:
+    SignalInfo() : _si{} {}
+    explicit SignalInfo(const struct signalfd_siginfo & si) : _si(si) {}
+
+    int signo() const { return _si.ssi_signo; }
+
+    // Nothing for signals that have no Signal enumerator
+    cpp::Maybe<Signal> signal() const {
+        return cpp::_to_enum<SignalCheck, Signal>(signo());
+    }
+
+    int      code()   const { return _si.ssi_code; }    // SI_USER, SI_QUEUE, ...
+    pid_t    pid()    const { return _si.ssi_pid; }     // sender, for kill() and sigqueue()
+    uid_t    uid()    const { return _si.ssi_uid; }
+    int      status() const { return _si.ssi_status; }  // exit status, for SIGCHLD
+    int32_t  value()  const { return _si.ssi_int; }     // sigqueue() payload
+
+    const struct signalfd_siginfo & raw() const { return _si; }
+private:
+    struct signalfd_siginfo _si;
+};
+
+// Signals delivered through a file descriptor instead of a handler, so they can be
+// waited for together with sockets (register __fd() with Epoll for Input events, or
+// use epoll::SignalHandler with an EventLoop).
+//
+// The constructor blocks 'sigs' in the calling thread, otherwise they would still be
+// delivered the usual way. A process wide signal is delivered to any thread that does
+// not block it, so create the SignalFd before starting other threads. The mask is
+// left as is on destruction.
+class SignalFd {
+public:
+    SignalFd(const std::initializer_list<Signal> & sigs,
+             cpp::Flags<SignalFdFlag> fl = {SignalFdFlag::CloseOnExec, SignalFdFlag::NonBlock})
+    : _nonblock(fl.contains(SignalFdFlag::NonBlock))
+    {
+        sigemptyset(&_mask);
+        for(auto s : sigs){
+            sigaddset(&_mask, cpp::to_underlying(s));
+        }
+        int ret = ::pthread_sigmask(SIG_BLOCK, &_mask, nullptr);
+        if(ret != 0){
+            throw std::runtime_error("pthread_sigmask(): " + _unix::errno_str(ret));
+        }
+        _fd = ::signalfd(-1, &_mask, cpp::to_int(fl));
+        if(_fd < 0){
+            throw std::runtime_error("signalfd(): " + _unix::errno_str(errno));
+        }
+    }
+    ~SignalFd(){
+        if(_fd >= 0){
+            ::close(_fd);
+            _fd = -1;
+        }
+    }
+
+    // RO3
+    SignalFd(const SignalFd &)            = delete;
+    SignalFd& operator=(const SignalFd &) = delete;
+    SignalFd(SignalFd && o) : _fd(o._fd), _mask(o._mask), _nonblock(o._nonblock) { o._fd = -1; }
+    SignalFd& operator=(SignalFd && o) {
+        std::swap(_fd, o._fd);
+        std::swap(_mask, o._mask);
+        std::swap(_nonblock, o._nonblock);
+        return *this;
+    }
+
+    // Next pending signal. Blocks unless SignalFdFlag::NonBlock was given. Nothing if
+    // none is pending (non-blocking mode) or on error (check errno).
+    cpp::Maybe<SignalInfo> read(){
+        struct signalfd_siginfo si;
+        if(::read(_fd, &si, sizeof(si)) != sizeof(si)){
+            return cpp::Nothing();
+        }
+        return SignalInfo(si);
+    }
+
+    bool watches(Signal s) const { return sigismember(&_mask, cpp::to_underlying(s)) == 1; }
+    bool nonblocking() const { return _nonblock; }
+
+    int __fd() const { return _fd; }
+private:
+    int      _fd;
+    sigset_t _mask;
+    bool     _nonblock;
+};
+
 } // ns signals
 
 } // ns unix
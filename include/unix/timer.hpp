@@ -0,0 +1,230 @@
+#pragma once
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+
+#include <cpp.hpp>
+#include <unix/common.hpp>
+#include <unix/epoll.hpp>
+
+namespace _unix {
+
+enum class ClockId {
+    Realtime  = CLOCK_REALTIME,
+    Monotonic = CLOCK_MONOTONIC,
+    Boottime  = CLOCK_BOOTTIME,
+};
+
+enum class TimerFdFlag {
+    CloseOnExec = TFD_CLOEXEC,
+    NonBlock    = TFD_NONBLOCK,
+};
+
+using NanoSeconds = std::chrono::nanoseconds;
+
+// Current time of 'c' since its epoch
+inline NanoSeconds clock_now(ClockId c){
+    struct timespec ts;
+    ::clock_gettime(cpp::to_underlying(c), &ts);
+    return std::chrono::seconds(ts.tv_sec) + NanoSeconds(ts.tv_nsec);
+}
+
+// Kernel timer delivering expirations through a file descriptor. Register __fd()
+// with Epoll for Input events; consume() returns the number of expirations since
+// the last read.
+class TimerFd {
+public:
+    TimerFd(ClockId clock = ClockId::Monotonic,
+            cpp::Flags<TimerFdFlag> fl = {TimerFdFlag::CloseOnExec, TimerFdFlag::NonBlock})
+    : _fd(::timerfd_create(cpp::to_underlying(clock), cpp::to_int(fl))), _clock(clock)
+    {
+        if(_fd < 0){
+            throw std::runtime_error("timerfd_create(): " + _unix::errno_str(errno));
+        }
+    }
+    ~TimerFd(){
+        if(_fd >= 0){
+            ::close(_fd);
+            _fd = -1;
+        }
+    }
+
+    // RO3
+    TimerFd(const TimerFd &)            = delete;
+    TimerFd& operator=(const TimerFd &) = delete;
+    TimerFd(TimerFd && o) : _fd(o._fd), _clock(o._clock) { o._fd = -1; }
+    TimerFd& operator=(TimerFd && o) { std::swap(_fd, o._fd); std::swap(_clock, o._clock); return *this; }
+
+    // Expire after 'initial', then every 'interval' (0 = once). A zero 'initial'
+    // would disarm the timer, so it is bumped to 1ns. Returns 0 or -1 and errno.
+    int arm(NanoSeconds initial, NanoSeconds interval = NanoSeconds(0)){
+        return _settime(0, initial.count() > 0 ? initial : NanoSeconds(1), interval);
+    }
+    // Expire once when the clock reaches 'when' (as returned by clock_now()).
+    // A time in the past expires immediately.
+    int arm_at(NanoSeconds when){
+        return _settime(TFD_TIMER_ABSTIME, when.count() > 0 ? when : NanoSeconds(1), NanoSeconds(0));
+    }
+    int disarm(){
+        return _settime(0, NanoSeconds(0), NanoSeconds(0));
+    }
+
+    // Number of expirations since the last call. Nothing if there were none
+    // (non-blocking mode) or on error.
+    cpp::Maybe<uint64_t> consume(){
+        uint64_t v = 0;
+        if(::read(_fd, &v, sizeof(v)) != sizeof(v)){
+            return cpp::Nothing();
+        }
+        return v;
+    }
+
+    ClockId clock() const { return _clock; }
+    int __fd() const { return _fd; }
+private:
+    static struct timespec _ts(NanoSeconds ns){
+        struct timespec ts;
+        ts.tv_sec  = ns.count() / 1000000000;
+        ts.tv_nsec = ns.count() % 1000000000;
+        return ts;
+    }
+    int _settime(int flags, NanoSeconds value, NanoSeconds interval){
+        struct itimerspec its;
+        its.it_value    = _ts(value);
+        its.it_interval = _ts(interval);
+        return ::timerfd_settime(_fd, flags, &its, nullptr);
+    }
+
+    int     _fd;
+    ClockId _clock;
+};
+
+class TimerWheel;
+
+// A timer scheduled on a TimerWheel. The object is the list node itself, so
+// scheduling and cancelling do not allocate. It must not move while scheduled;
+// destroying it cancels it.
+class Timer {
+public:
+    using Callback = std::function<void(Timer &)>;
+
+    explicit Timer(Callback cb = nullptr) : _cb(std::move(cb)) { _link.owner = this; }
+    ~Timer() { cancel(); }
+
+    // RO3
+    Timer(const Timer &)            = delete;
+    Timer& operator=(const Timer &) = delete;
+
+    void set_callback(Callback cb) { _cb = std::move(cb); }
+
+    bool active() const { return _wheel != nullptr; }
+
+    // No-op if not scheduled
+    inline void cancel();
+
+private:
+    friend class TimerWheel;
+
+    // Circular doubly linked list; slots of the wheel have a sentinel node
+    // (owner == nullptr)
+    struct Link {
+        Link *  prev  = this;
+        Link *  next  = this;
+        Timer * owner = nullptr;
+        bool empty() const { return next == this; }
+    };
+    Link         _link;
+    uint64_t     _expires = 0;          // in wheel ticks
+    uint8_t      _level   = 0;
+    uint8_t      _slot    = 0;
+    TimerWheel * _wheel   = nullptr;
+    Callback     _cb;
+};
+
+// Hierarchical timing wheel: 6 levels of 64 slots, level n covering 64^(n+1) ticks.
+// schedule() and cancel() are O(1); timers far in the future are moved down a level
+// ("cascaded") as their time comes closer. With the default 1ms tick the wheel spans
+// about two years; later timers are parked in the last level until they fit.
+//
+// The wheel owns a TimerFd which is armed (absolute, nanosecond resolution) for the
+// next tick at which anything has to be done, and is disarmed when no timers are
+// scheduled. Register it with an EventLoop:
+//
+//   TimerWheel wheel;
+//   loop.add(wheel.__fd(), wheel, {EpollEventType::Input});
+//
+// On each wakeup all timers that are due are fired, slot by slot, in the loop's
+// thread. Callbacks may schedule or cancel any timer, including their own, but
+// must not destroy their own Timer object.
+// A timer fires no earlier than requested, and at most one tick late (plus
+// scheduling latency). Not thread safe.
+class TimerWheel : public _unix::epoll::EventHandler {
+public:
+    static constexpr unsigned levels    = 6;
+    static constexpr unsigned slot_bits = 6;
+    static constexpr unsigned slots     = 1u << slot_bits;
+
+    // Throws std::runtime_error if the timerfd cannot be created
+    explicit TimerWheel(NanoSeconds tick = std::chrono::milliseconds(1), ClockId clock = ClockId::Monotonic);
+    ~TimerWheel();
+
+    // RO3. Timers point to the wheel.
+    TimerWheel(const TimerWheel &)            = delete;
+    TimerWheel& operator=(const TimerWheel &) = delete;
+
+    // (Re)schedule 't' to fire after 'delay'. An active timer is moved.
+    void schedule(Timer & t, NanoSeconds delay);
+    // Same, replacing the callback
+    void schedule(Timer & t, NanoSeconds delay, Timer::Callback cb){
+        t.set_callback(std::move(cb));
+        schedule(t, delay);
+    }
+    void cancel(Timer & t);
+
+    // Fire everything that is due by now. Called from on_event(); call it directly
+    // when not using the timerfd. Returns the number of timers fired.
+    size_t advance();
+
+    void on_event(const _unix::epoll::EpollEvent & ev) override;
+
+    size_t      size() const { return _count; }
+    NanoSeconds tick() const { return _tick; }
+    int __fd() const { return _fd.__fd(); }
+
+private:
+    using Link = Timer::Link;
+
+    uint64_t _clock_ticks() const;
+    void     _insert(Timer & t);
+    void     _unlink(Timer & t);
+    void     _cascade();
+    size_t   _fire(unsigned slot);
+    void     _rearm();
+    uint64_t _next_wakeup() const;
+
+    TimerFd     _fd;
+    bool        _advancing;
+    NanoSeconds _tick;
+    NanoSeconds _origin;    // clock time of tick 0
+    uint64_t    _now;       // last processed tick
+    uint64_t    _armed;     // tick the timerfd is armed for, or ~0
+    size_t      _count;
+
+    std::array<std::array<Link, slots>, levels> _wheel;
+    std::array<uint64_t, levels>                _bits;  // non-empty slots
+};
+
+inline void Timer::cancel(){
+    if(_wheel){
+        _wheel->cancel(*this);
+    }
+}
+
+} // ns _unix
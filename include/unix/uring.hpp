@@ -0,0 +1,352 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+#include <cpp.hpp>
+#include <unix/common.hpp>
+#include <unix/inet.hpp>
+
+namespace _unix {
+
+namespace uring {
+
+// Completion based counterpart of Epoll: operations are queued into the submission
+// ring, handed to the kernel with a single io_uring_enter(), and their results are
+// reaped from the completion ring in batches.
+//
+// Talks to the kernel directly (no liburing), so only needs <linux/io_uring.h>.
+
+enum class SetupFlag : uint32_t {
+    IoPoll          = IORING_SETUP_IOPOLL,
+    SqPoll          = IORING_SETUP_SQPOLL,
+    SqAffinity      = IORING_SETUP_SQ_AFF,
+    CqSize          = IORING_SETUP_CQSIZE,
+    Clamp           = IORING_SETUP_CLAMP,
+    SubmitAll       = IORING_SETUP_SUBMIT_ALL,
+    CoopTaskRun     = IORING_SETUP_COOP_TASKRUN,
+    SingleIssuer    = IORING_SETUP_SINGLE_ISSUER,
+};
+
+enum class SqeFlag : uint8_t {
+    FixedFile       = IOSQE_FIXED_FILE,
+    Drain           = IOSQE_IO_DRAIN,
+    Link            = IOSQE_IO_LINK,
+    HardLink        = IOSQE_IO_HARDLINK,
+    Async           = IOSQE_ASYNC,
+    BufferSelect    = IOSQE_BUFFER_SELECT,
+    SkipSuccess     = IOSQE_CQE_SKIP_SUCCESS,
+};
+
+enum class CqeFlag : uint32_t {
+    Buffer          = IORING_CQE_F_BUFFER,      // buffer_id() is valid
+    More            = IORING_CQE_F_MORE,        // multishot request is still armed
+    SockNonEmpty    = IORING_CQE_F_SOCK_NONEMPTY,
+    Notification    = IORING_CQE_F_NOTIF,
+};
+
+enum class Opcode : uint8_t {
+    Nop             = IORING_OP_NOP,
+    RecvMsg         = IORING_OP_RECVMSG,
+    SendMsg         = IORING_OP_SENDMSG,
+    Accept          = IORING_OP_ACCEPT,
+    Send            = IORING_OP_SEND,
+    Recv            = IORING_OP_RECV,
+    SendZeroCopy    = IORING_OP_SEND_ZC,
+};
+
+// Target of an operation: either an ordinary file descriptor (from a Socket), or an
+// index into the files registered with IoUring::register_files().
+class Target {
+public:
+    Target(const _unix::inet::Socket & s) : _fd(s.__fd()), _fixed(false) {}
+
+    static Target fixed(unsigned index) { return Target(static_cast<int>(index), true); }
+
+    int  fd()       const { return _fd; }
+    bool is_fixed() const { return _fixed; }
+private:
+    Target(int fd, bool fixed) : _fd(fd), _fixed(fixed) {}
+    int  _fd;
+    bool _fixed;
+};
+
+using _CQE = struct io_uring_cqe;
+
+class Completion : public _CQE
+{
+public:
+    uint64_t user_data() const { return this->_CQE::user_data; }
+
+    // Return value of the operation; negative values are -errno
+    int32_t result() const { return this->res; }
+
+    bool has_flag(CqeFlag f) const { return this->flags & cpp::to_underlying(f); }
+
+    // Id of the provided buffer chosen by the kernel (CqeFlag::Buffer)
+    uint16_t buffer_id() const { return this->flags >> IORING_CQE_BUFFER_SHIFT; }
+};
+
+class IoUring;
+
+// Ring of buffers provided to the kernel (IORING_REGISTER_PBUF_RING, Linux >= 5.19).
+// Operations submitted with a buffer group id pick a buffer from here, and report
+// the chosen buffer in Completion::buffer_id(). Hand the buffer back with
+// recycle() once done with it.
+//
+// 'count' must be a power of two.
+class BufferRing {
+public:
+    BufferRing(IoUring & ring, uint16_t group, unsigned count, size_t buf_size);
+    ~BufferRing();
+
+    BufferRing(const BufferRing &)            = delete;
+    BufferRing& operator=(const BufferRing &) = delete;
+
+    uint16_t group()       const { return _group; }
+    size_t   buffer_size() const { return _buf_size; }
+
+    uint8_t * data(uint16_t bid) const { return _bufs + size_t(bid) * _buf_size; }
+
+    // Queue buffer 'bid' for reuse. Call publish() after a batch of recycles.
+    void recycle(uint16_t bid){
+        auto & b = _ring[(_tail + _pending) & _mask];
+        b.addr = reinterpret_cast<uint64_t>(data(bid));
+        b.len  = _buf_size;
+        b.bid  = bid;
+        ++_pending;
+    }
+    void publish(){
+        _tail += _pending;
+        _pending = 0;
+        // The ring tail overlays the 'resv' field of the first entry
+        __atomic_store_n(&_ring[0].resv, _tail, __ATOMIC_RELEASE);
+    }
+
+private:
+    IoUring &                   _uring;
+    // Not struct io_uring_buf_ring: its flexible array member puts 'bufs' at
+    // offset 8 when compiled as C++.
+    struct io_uring_buf *       _ring;
+    size_t                      _ring_bytes;
+    uint8_t *                   _bufs;
+    size_t                      _buf_size;
+    unsigned                    _count;
+    uint16_t                    _mask;
+    uint16_t                    _tail;
+    uint16_t                    _pending;
+    uint16_t                    _group;
+};
+
+class IoUring {
+public:
+    IoUring(unsigned entries, cpp::Flags<SetupFlag> fl = {});
+    ~IoUring();
+
+    // RO3
+    IoUring(const IoUring &)            = delete;
+    IoUring& operator=(const IoUring &) = delete;
+
+    // --------------------------------------
+    // Preparation of operations. Each returns false if the submission queue is full;
+    // in that case submit() and try again.
+
+    bool nop(uint64_t user_data){
+        return _prep(Opcode::Nop, -1, false, nullptr, 0, user_data) != nullptr;
+    }
+
+    bool recv(Target t, uint8_t * buf, size_t len, uint64_t user_data,
+              cpp::Flags<_unix::inet::RecvFlag> fl = {})
+    {
+        auto * sqe = _prep(Opcode::Recv, t.fd(), t.is_fixed(), buf, len, user_data);
+        if(sqe){ sqe->msg_flags = cpp::to_int(fl); }
+        return sqe != nullptr;
+    }
+
+    bool send(Target t, const uint8_t * buf, size_t len, uint64_t user_data,
+              cpp::Flags<_unix::inet::SendFlag> fl = {})
+    {
+        auto * sqe = _prep(Opcode::Send, t.fd(), t.is_fixed(), buf, len, user_data);
+        if(sqe){ sqe->msg_flags = cpp::to_int(fl); }
+        return sqe != nullptr;
+    }
+
+    // The msghdr (and everything it points to) must stay valid until completion
+    bool recvmsg(Target t, struct msghdr * mh, uint64_t user_data,
+                 cpp::Flags<_unix::inet::RecvFlag> fl = {})
+    {
+        auto * sqe = _prep(Opcode::RecvMsg, t.fd(), t.is_fixed(), mh, 1, user_data);
+        if(sqe){ sqe->msg_flags = cpp::to_int(fl); }
+        return sqe != nullptr;
+    }
+
+    bool sendmsg(Target t, const struct msghdr * mh, uint64_t user_data,
+                 cpp::Flags<_unix::inet::SendFlag> fl = {})
+    {
+        auto * sqe = _prep(Opcode::SendMsg, t.fd(), t.is_fixed(), mh, 1, user_data);
+        if(sqe){ sqe->msg_flags = cpp::to_int(fl); }
+        return sqe != nullptr;
+    }
+
+    // Completion result is the new file descriptor. If 'ss'/'len' are given, they
+    // must stay valid until completion; the peer address is stored there.
+    bool accept(Target t, uint64_t user_data,
+                struct sockaddr_storage * ss = nullptr, socklen_t * len = nullptr)
+    {
+        auto * sqe = _prep(Opcode::Accept, t.fd(), t.is_fixed(), ss, 0, user_data);
+        if(sqe){
+            sqe->addr2 = reinterpret_cast<uint64_t>(len);
+            sqe->accept_flags = SOCK_CLOEXEC;
+        }
+        return sqe != nullptr;
+    }
+
+    // Zero-copy send (IORING_OP_SEND_ZC, Linux >= 6.0; TCP and UDP) from a buffer registered with
+    // register_buffers(). 'buf' must point inside the registered buffer 'index'.
+    // Produces two completions with the same user_data: the result, with
+    // CqeFlag::More set, and later one with CqeFlag::Notification once the kernel
+    // no longer reads the buffer. Do not reuse the buffer before the second one.
+    //
+    // There is no fixed buffer receive for sockets; use recv_multishot() with a
+    // BufferRing instead.
+    bool send_fixed(Target t, const uint8_t * buf, size_t len, uint16_t index, uint64_t user_data,
+                    cpp::Flags<_unix::inet::SendFlag> fl = {})
+    {
+        auto * sqe = _prep(Opcode::SendZeroCopy, t.fd(), t.is_fixed(), buf, len, user_data);
+        if(sqe){
+            sqe->msg_flags = cpp::to_int(fl);
+            sqe->ioprio    = IORING_RECVSEND_FIXED_BUF;
+            sqe->buf_index = index;
+        }
+        return sqe != nullptr;
+    }
+
+    // One submission, one completion per received datagram/chunk for as long as the
+    // completion has CqeFlag::More set. Buffers are taken from 'br'.
+    bool recv_multishot(Target t, const BufferRing & br, uint64_t user_data){
+        auto * sqe = _prep(Opcode::Recv, t.fd(), t.is_fixed(), nullptr, 0, user_data);
+        if(sqe){
+            sqe->ioprio    = IORING_RECV_MULTISHOT;
+            sqe->flags    |= cpp::to_underlying(SqeFlag::BufferSelect);
+            sqe->buf_group = br.group();
+        }
+        return sqe != nullptr;
+    }
+
+    // Add extra flags (links, async, ...) to the most recently prepared operation
+    void set_flags(cpp::Flags<SqeFlag> fl){
+        if(_sq.sqe_tail != _sq.sqe_head){
+            _sqes[(_sq.sqe_tail - 1) & *_sq.mask].flags |= cpp::to_int(fl);
+        }
+    }
+
+    // --------------------------------------
+
+    // Hand all prepared operations to the kernel. Returns the number submitted,
+    // or -1 and errno.
+    int submit() { return _enter(0); }
+
+    // Like submit(), and also block until at least 'n' completions are available.
+    int submit_and_wait(unsigned n) { return _enter(n); }
+
+    unsigned ready() const {
+        return __atomic_load_n(_cq.tail, __ATOMIC_ACQUIRE) - *_cq.head;
+    }
+
+    // Reap all available completions in one go: calls f(const Completion &) for each,
+    // then releases them to the kernel with a single store. Returns the count.
+    template <typename F>
+    unsigned for_each_completion(F f){
+        unsigned head = *_cq.head;
+        unsigned tail = __atomic_load_n(_cq.tail, __ATOMIC_ACQUIRE);
+        unsigned n = 0;
+        for(; head != tail; ++head, ++n){
+            f(static_cast<const Completion &>(_cq.cqes[head & *_cq.mask]));
+        }
+        __atomic_store_n(_cq.head, head, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    // Copy up to 'max' completions into 'out'. Returns the count.
+    unsigned reap(Completion * out, unsigned max){
+        unsigned head = *_cq.head;
+        unsigned tail = __atomic_load_n(_cq.tail, __ATOMIC_ACQUIRE);
+        unsigned n = 0;
+        for(; head != tail && n < max; ++head, ++n){
+            out[n] = static_cast<const Completion &>(_cq.cqes[head & *_cq.mask]);
+        }
+        __atomic_store_n(_cq.head, head, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    // --------------------------------------
+    // Registration. All return 0 on success, or -1 and errno.
+
+    int register_buffers(const std::vector<struct iovec> & bufs);
+    int unregister_buffers();
+
+    // Index i in 'socks' can then be used with Target::fixed(i)
+    int register_files(const std::vector<const _unix::inet::Socket *> & socks);
+    int unregister_files();
+
+    // Used by BufferRing
+    int __register(unsigned opcode, const void * arg, unsigned nr_args);
+
+    int __fd() const { return _ring_fd; }
+
+private:
+    struct io_uring_sqe * _prep(Opcode op, int fd, bool fixed, const void * addr,
+                                uint32_t len, uint64_t user_data)
+    {
+        unsigned head = __atomic_load_n(_sq.head, __ATOMIC_ACQUIRE);
+        if(_sq.sqe_tail - head >= *_sq.entries){
+            return nullptr;
+        }
+        auto * sqe = &_sqes[_sq.sqe_tail & *_sq.mask];
+        ++_sq.sqe_tail;
+
+        *sqe = {};
+        sqe->opcode    = cpp::to_underlying(op);
+        sqe->fd        = fd;
+        sqe->flags     = fixed ? cpp::to_underlying(SqeFlag::FixedFile) : 0;
+        sqe->addr      = reinterpret_cast<uint64_t>(addr);
+        sqe->len       = len;
+        sqe->user_data = user_data;
+        return sqe;
+    }
+
+    int _enter(unsigned wait_nr);
+
+    struct {
+        unsigned * head;
+        unsigned * tail;
+        unsigned * mask;
+        unsigned * entries;
+        unsigned * array;
+        unsigned   sqe_head;    // [sqe_head, sqe_tail) are prepared, but not yet
+        unsigned   sqe_tail;    // published to the kernel
+    } _sq;
+
+    struct {
+        unsigned * head;
+        unsigned * tail;
+        unsigned * mask;
+        struct io_uring_cqe * cqes;
+    } _cq;
+
+    struct io_uring_sqe * _sqes;
+
+    void *  _sq_ptr;
+    size_t  _sq_bytes;
+    void *  _cq_ptr;
+    size_t  _cq_bytes;
+    size_t  _sqes_bytes;
+    int     _ring_fd;
+};
+
+} // ns uring
+
+} // ns _unix
@@ -0,0 +1,145 @@
+#include <sys/mman.h>
+
+#include <new>
+#include <stdexcept>
+
+#include <unix/bufpool.hpp>
+#include <unix/common.hpp>
+
+namespace _unix {
+
+namespace {
+constexpr size_t huge_page = 2 * 1024 * 1024;
+
+size_t _round_up(size_t v, size_t to){
+    return (v + to - 1) / to * to;
+}
+
+// Caches active in the current thread, most recent first
+thread_local BufferPool::Cache * tls_caches = nullptr;
+} // anon ns
+
+BufferPool::BufferPool(size_t slot_size, uint32_t count)
+: _slot_size(_round_up(slot_size, cache_line)), _count(count), _bytes(0),
+  _huge(false), _base(nullptr), _meta(nullptr)
+{
+    if(slot_size == 0 || count == 0){
+        throw std::runtime_error("BufferPool: slot size and count must be non-zero");
+    }
+
+    // Explicit huge pages first, then fall back to normal pages + THP
+    static_assert(sizeof(Meta) == cache_line, "one Meta per cache line");
+    _bytes = _round_up((_slot_size + sizeof(Meta)) * count, huge_page);
+    void * p = ::mmap(nullptr, _bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(p != MAP_FAILED){
+        _huge = true;
+    }
+    else {
+        p = ::mmap(nullptr, _bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(p == MAP_FAILED){
+            throw std::runtime_error("BufferPool mmap(): " + _unix::errno_str(errno));
+        }
+        ::madvise(p, _bytes, MADV_HUGEPAGE);
+    }
+    _base = static_cast<uint8_t*>(p);
+    // Slots are whole cache lines, so the metadata after them is line aligned too
+    _meta = reinterpret_cast<Meta*>(_base + _slot_size * count);
+    for(uint32_t i = 0; i < count; ++i){
+        new (&_meta[i]) Meta{};
+    }
+
+    // Hand out low indices first, so a lightly used pool touches few pages
+    _free.reserve(count);
+    for(uint32_t i = count; i > 0; --i){
+        _free.push_back(i - 1);
+    }
+}
+
+BufferPool::~BufferPool(){
+    ::munmap(_base, _bytes);
+}
+
+size_t BufferPool::available(){
+    std::lock_guard<std::mutex> g(_lock);
+    return _free.size();
+}
+
+BufferPool::Cache * BufferPool::_local_cache(){
+    for(auto * c = tls_caches; c != nullptr; c = c->_next){
+        if(&c->_pool == this){
+            return c;
+        }
+    }
+    return nullptr;
+}
+
+PoolBuffer BufferPool::acquire(){
+    uint32_t i;
+    auto * c = _local_cache();
+    if(c != nullptr){
+        if(c->_free.empty()){
+            std::lock_guard<std::mutex> g(_lock);
+            for(uint32_t n = 0; n < c->_batch && !_free.empty(); ++n){
+                c->_free.push_back(_free.back());
+                _free.pop_back();
+            }
+        }
+        if(c->_free.empty()){
+            return PoolBuffer();
+        }
+        i = c->_free.back();
+        c->_free.pop_back();
+    }
+    else {
+        std::lock_guard<std::mutex> g(_lock);
+        if(_free.empty()){
+            return PoolBuffer();
+        }
+        i = _free.back();
+        _free.pop_back();
+    }
+    _meta[i].refs.store(1, std::memory_order_relaxed);
+    _meta[i].size = 0;
+    return PoolBuffer(this, i);
+}
+
+void BufferPool::_release(uint32_t i){
+    auto * c = _local_cache();
+    if(c != nullptr){
+        c->_free.push_back(i);
+        if(c->_free.size() >= 2 * c->_batch){
+            std::lock_guard<std::mutex> g(_lock);
+            for(uint32_t n = 0; n < c->_batch; ++n){
+                _free.push_back(c->_free.back());
+                c->_free.pop_back();
+            }
+        }
+        return;
+    }
+    std::lock_guard<std::mutex> g(_lock);
+    _free.push_back(i);
+}
+
+BufferPool::Cache::Cache(BufferPool & pool, uint32_t batch)
+: _pool(pool), _batch(batch ? batch : 1), _next(tls_caches)
+{
+    _free.reserve(2 * _batch);
+    tls_caches = this;
+}
+
+BufferPool::Cache::~Cache(){
+    // Unlink, then give everything back
+    for(auto ** pc = &tls_caches; *pc != nullptr; pc = &(*pc)->_next){
+        if(*pc == this){
+            *pc = _next;
+            break;
+        }
+    }
+    std::lock_guard<std::mutex> g(_pool._lock);
+    for(auto i : _free){
+        _pool._free.push_back(i);
+    }
+}
+
+} // ns _unix
@@ -0,0 +1,71 @@
+
+// Echo servers on the coroutine layer (unix/coro.hpp): UDP and TCP on the same
+// port, one coroutine per TCP connection.
+//
+//   ./coro_echo 9000
+
+#include <iostream>
+#include <string>
+
+#include <unix/coro.hpp>
+
+namespace unix = _unix;
+namespace coro = _unix::coro;
+
+coro::Task<void> udp_echo(coro::AsyncSocket s){
+    uint8_t buf[9000];
+    while(true){
+        auto p = co_await s.async_recvfrom(buf, sizeof(buf));
+        if(p.first < 0 || !p.second){
+            std::cerr << "recvfrom(): " << unix::errno_str(errno) << std::endl;
+            co_return;
+        }
+        co_await s.async_sendto(buf, p.first, *p.second);
+    }
+}
+
+coro::Task<void> tcp_session(coro::AsyncSocket s){
+    uint8_t buf[4096];
+    while(true){
+        auto n = co_await s.async_recv(buf, sizeof(buf));
+        if(n <= 0){
+            co_return;
+        }
+        for(ssize_t off = 0; off < n; ){
+            auto m = co_await s.async_send(buf + off, n - off, unix::inet::SendFlag::NoSignal);
+            if(m < 0){
+                co_return;
+            }
+            off += m;
+        }
+    }
+}
+
+coro::Task<void> tcp_listen(coro::Reactor & r, coro::AsyncSocket s){
+    while(true){
+        auto c = co_await s.async_accept();
+        if(!c){
+            std::cerr << "accept(): " << unix::errno_str(errno) << std::endl;
+            // Out of descriptors, most likely: back off for a while
+            co_await r.sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        coro::spawn(tcp_session(coro::AsyncSocket(r, std::move(c->socket))));
+    }
+}
+
+int main(int argc, char * argv[]){
+    const std::string port = (argc > 1) ? argv[1] : "9000";
+
+    auto u = unix::inet::server_socket_udp("0.0.0.0", port);
+    auto t = unix::inet::server_socket_tcp("0.0.0.0", port);
+    if(!u || !t){
+        std::cerr << "cannot bind to port " << port << std::endl;
+        return 1;
+    }
+
+    coro::Reactor r;
+    coro::spawn(udp_echo(coro::AsyncSocket(r, std::move(*u))));
+    coro::spawn(tcp_listen(r, coro::AsyncSocket(r, std::move(*t))));
+    return r.run();
+}
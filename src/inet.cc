@@ -2,10 +2,17 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 #include <string.h>
 #include <fcntl.h>
+#include <netinet/udp.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
 
+#include <cstddef>
 #include <iostream>
 #include <sstream>
 #include <vector>
@@ -15,6 +22,7 @@
 
 #include <unix/inet.hpp>
 #include <unix/common.hpp>
+#include <unix/log.hpp>
 
 #include <cpp.hpp>
 
@@ -26,15 +34,6 @@ namespace inet
 
 using namespace cpp;
 
-// int_to_flags
-int flags_to_int(const std::vector<AIFlag> & fv){
-    int flags = 0;
-    for(const auto & f : fv){
-        flags |= to_underlying(f);
-    }
-    return flags;
-}
-
 
 const struct sockaddr* SockAddr::addr() const {
     return reinterpret_cast<const struct sockaddr*>(&_ss);
@@ -66,46 +65,209 @@ uint16_t SockAddr::port() const {
     }
 }
 
-std::string SockAddr::address() const {
-    char buf[INET6_ADDRSTRLEN+1];
+constexpr size_t SockAddr::max_unix_len;
+constexpr size_t SockAddr::max_address_len;
+constexpr size_t SockAddr::max_address_and_port_len;
+
+namespace {
+// sun_path offset; the name follows, and the length of the address gives its end
+constexpr socklen_t unix_name_offset = offsetof(struct sockaddr_un, sun_path);
+
+Maybe<SockAddr> _unix_address(const char * prefix, size_t plen, const std::string & name, bool terminate){
+    struct sockaddr_un un = {};
+    // A path needs room for its NUL terminator, an abstract name does not
+    if(plen + name.size() + (terminate ? 1 : 0) > sizeof(un.sun_path)){
+        errno = ENAMETOOLONG;
+        return Nothing();
+    }
+    un.sun_family = AF_UNIX;
+    memcpy(un.sun_path, prefix, plen);
+    memcpy(un.sun_path + plen, name.data(), name.size());
+    socklen_t len = unix_name_offset + plen + name.size() + (terminate ? 1 : 0);
+    return SockAddr::from_struct(reinterpret_cast<struct sockaddr*>(&un), len, false);
+}
+} // anon ns
+
+Maybe<SockAddr> SockAddr::unix_path(const std::string & path){
+    return _unix_address("", 0, path, true);
+}
+
+Maybe<SockAddr> SockAddr::unix_abstract(const std::string & name){
+    return _unix_address("\0", 1, name, false);
+}
+
+bool SockAddr::is_abstract() const {
+    auto * un = reinterpret_cast<const struct sockaddr_un*>(&_ss);
+    return family() == AddressFamily::Unix && _len > unix_name_offset && un->sun_path[0] == '\0';
+}
+
+namespace {
+FormatResult _copy(char * first, char * last, const char * s, size_t n){
+    if(size_t(last - first) < n){
+        return FormatResult{last, false};
+    }
+    memcpy(first, s, n);
+    return FormatResult{first + n, true};
+}
+template <size_t N>
+FormatResult _copy(char * first, char * last, const char (&s)[N]){
+    return _copy(first, last, s, N - 1);
+}
+FormatResult _format_u16(char * first, char * last, uint16_t v){
+    char tmp[5];
+    size_t n = 0;
+    do {
+        tmp[sizeof(tmp) - ++n] = '0' + (v % 10);
+        v /= 10;
+    } while(v != 0);
+    return _copy(first, last, tmp + sizeof(tmp) - n, n);
+}
+} // anon ns
+
+FormatResult SockAddr::format_address(char * first, char * last) const {
+    // inet_ntop needs room for the NUL, so format on the stack first
+    char buf[INET6_ADDRSTRLEN];
     auto fam = family();
     switch (fam){
         case AddressFamily::Any:
-            return "<Any/Unknown address>";
-            break;
+            return _copy(first, last, "<Any/Unknown address>");
         case AddressFamily::IPv4: {
             auto * p = reinterpret_cast<const struct sockaddr_in*>(&_ss);
             auto * n = inet_ntop(to_underlying(fam), &(p->sin_addr), buf, sizeof(buf));
-            return (n == nullptr) ? "<invalid ipv4 address>" : std::string(buf);
-            break;
+            return (n == nullptr) ? _copy(first, last, "<invalid ipv4 address>")
+                                  : _copy(first, last, buf, strlen(buf));
         }
         case AddressFamily::IPv6: {
             auto * p = reinterpret_cast<const struct sockaddr_in6*>(&_ss);
             auto * n = inet_ntop(to_underlying(fam), &(p->sin6_addr), buf, sizeof(buf));
-            return (n == nullptr) ? "<invalid ipv6 address>" : std::string(buf);
-            break;
+            return (n == nullptr) ? _copy(first, last, "<invalid ipv6 address>")
+                                  : _copy(first, last, buf, strlen(buf));
         }
-        /*
         case AddressFamily::Unix: {
-            break;
+            auto * un = reinterpret_cast<const struct sockaddr_un*>(&_ss);
+            if(_len <= unix_name_offset){
+                return _copy(first, last, "<unnamed>");
+            }
+            size_t n = std::min<size_t>(_len - unix_name_offset, sizeof(un->sun_path));
+            if(un->sun_path[0] == '\0'){
+                auto r = _copy(first, last, "@");
+                return r.ok ? _copy(r.ptr, last, un->sun_path + 1, n - 1) : r;
+            }
+            return _copy(first, last, un->sun_path, strnlen(un->sun_path, n));
         }
-        */
         default:
-            throw std::runtime_error("Strange family code!?!?!");
-            break;
+            return FormatResult{last, false};
     };
 }
 
+FormatResult SockAddr::format_address_and_port(char * first, char * last) const {
+    if(family() == AddressFamily::Unix){
+        return format_address(first, last);
+    }
+    bool v6 = (family() == AddressFamily::IPv6);
+    FormatResult r{first, true};
+    if(v6){
+        r = _copy(r.ptr, last, "[");
+    }
+    if(r.ok){ r = format_address(r.ptr, last); }
+    if(r.ok){ r = v6 ? _copy(r.ptr, last, "]:") : _copy(r.ptr, last, ":"); }
+    if(r.ok){ r = _format_u16(r.ptr, last, port()); }
+    return r;
+}
+
+std::string SockAddr::address() const {
+    AddressBuffer buf;
+    auto r = format_address(buf.data(), buf.data() + buf.size());
+    if(!r.ok){
+        throw std::runtime_error("Strange family code!?!?!");
+    }
+    return std::string(buf.data(), r.ptr);
+}
+
+std::string SockAddr::address_and_port() const {
+    AddressBuffer buf;
+    auto r = format_address_and_port(buf.data(), buf.data() + buf.size());
+    if(!r.ok){
+        throw std::runtime_error("Strange family code!?!?!");
+    }
+    return std::string(buf.data(), r.ptr);
+}
+
+bool SockAddr::operator==(const SockAddr & o) const {
+    if(family() != o.family() || port() != o.port()){
+        return false;
+    }
+    switch(family()){
+        case AddressFamily::IPv4: {
+            auto * a = reinterpret_cast<const struct sockaddr_in*>(&_ss);
+            auto * b = reinterpret_cast<const struct sockaddr_in*>(&o._ss);
+            return a->sin_addr.s_addr == b->sin_addr.s_addr;
+        }
+        case AddressFamily::IPv6: {
+            auto * a = reinterpret_cast<const struct sockaddr_in6*>(&_ss);
+            auto * b = reinterpret_cast<const struct sockaddr_in6*>(&o._ss);
+            // The same link-local address on two interfaces is two different peers
+            return a->sin6_scope_id == b->sin6_scope_id
+                && memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr)) == 0;
+        }
+        default:
+            return _len == o._len && memcmp(&_ss, &o._ss, _len) == 0;
+    }
+}
+
+Maybe<PeerAddr> PeerAddr::from(const SockAddr & sa){
+    return from(sa.addr(), sa.addrlen());
+}
+
+Maybe<PeerAddr> PeerAddr::from(const struct sockaddr * sa, socklen_t len){
+    PeerAddr p;
+    if(sa->sa_family == AF_INET && len >= sizeof(struct sockaddr_in)){
+        auto * in = reinterpret_cast<const struct sockaddr_in*>(sa);
+        p._w[0]   = in->sin_addr.s_addr;
+        p._port   = ntohs(in->sin_port);
+        p._family = AF_INET;
+        return p;
+    }
+    if(sa->sa_family == AF_INET6 && len >= sizeof(struct sockaddr_in6)){
+        auto * in6 = reinterpret_cast<const struct sockaddr_in6*>(sa);
+        memcpy(p._w, &in6->sin6_addr, sizeof(p._w));
+        p._scope  = in6->sin6_scope_id;
+        p._port   = ntohs(in6->sin6_port);
+        p._family = AF_INET6;
+        return p;
+    }
+    return Nothing();
+}
+
+SockAddr PeerAddr::to_sockaddr() const {
+    if(_family == AF_INET6){
+        struct sockaddr_in6 in6 = {};
+        in6.sin6_family   = AF_INET6;
+        in6.sin6_port     = htons(_port);
+        in6.sin6_scope_id = _scope;
+        memcpy(&in6.sin6_addr, _w, sizeof(_w));
+        return *SockAddr::from_struct(reinterpret_cast<struct sockaddr*>(&in6), sizeof(in6), false);
+    }
+    struct sockaddr_in in = {};
+    in.sin_family      = AF_INET;
+    in.sin_port        = htons(_port);
+    in.sin_addr.s_addr = _w[0];
+    return *SockAddr::from_struct(reinterpret_cast<struct sockaddr*>(&in), sizeof(in), false);
+}
+
 std::string SockAddr::to_string(int level) const {
     std::string prefix(level*3, ' ');
-    std::stringstream ss;
-    ss
-    << prefix << "SockAddr {\n"
-    << prefix << "  family:  " << inet::to_string(family()) << "\n"
-    << prefix << "  port:    " << port() << "\n"
-    << prefix << "  address: " << address() << "\n"
-    << prefix << "}";
-    return ss.str();
+    AddressBuffer port_buf;
+    auto pr = _format_u16(port_buf.data(), port_buf.data() + port_buf.size(), port());
+
+    std::string s;
+    s.reserve(128 + 5 * prefix.size());
+    s.append(prefix).append("SockAddr {\n");
+    s.append(prefix).append("  family:  ").append(inet::to_string(family())).append("\n");
+    s.append(prefix).append("  port:    ").append(port_buf.data(), pr.ptr).append("\n");
+    s.append(prefix).append("  address: ").append(address()).append("\n");
+    s.append(prefix).append("}");
+    return s;
 }
 
 
@@ -113,15 +275,13 @@ AddrInfo::AddrInfo(
     AddressFamily af,
     SocketType type,
     Protocol proto,
-    const std::vector<AIFlag> & flags
+    Flags<AIFlag> flags
 ) {
     reset();
     set_family(af);
     set_socktype(type);
     set_protocol(proto);
-    for(auto & f : flags){
-        set_flag(f);
-    }
+    set_flags(flags);
 }
 std::string AddrInfo::to_string(int level) const {
     std::string prefix(level*2, ' ');
@@ -153,7 +313,7 @@ struct addrinfo AddrInfo::to_hints() const {
     h.ai_family   = to_underlying(family());
     h.ai_socktype = to_underlying(socket_type());
     h.ai_protocol = to_underlying(protocol());
-    h.ai_flags    = flags_to_int(flags());
+    h.ai_flags    = cpp::to_int(flags());
     return h;
 }
 
@@ -162,13 +322,13 @@ SocketType    AddrInfo::socket_type() const { return _st; }
 Protocol      AddrInfo::protocol()    const { return _pt; }
 
 socklen_t     AddrInfo::addr_len()    const { return bool(_sa) ? (*_sa).addrlen() : 0; }
-std::vector<AIFlag> AddrInfo::flags() const { return _flags; }
+Flags<AIFlag>  AddrInfo::flags()       const { return _flags; }
 
 void AddrInfo::set_params(
     AddressFamily af,
     SocketType st,
     Protocol pt,
-    const std::vector<AIFlag> & flags
+    Flags<AIFlag> flags
 ){
     // To keep this object in consistent state, the "output" variables need
     // to be reset if any "input" variables are changed
@@ -192,11 +352,11 @@ void AddrInfo::set_protocol(Protocol proto){
     _reset_outvars();
 }
 void AddrInfo::set_flag(AIFlag f) {
-    _flags.push_back(f);
+    _flags |= f;
     _reset_outvars();
 }
-void AddrInfo::set_flags(const std::vector<AIFlag> & fv){
-    _flags = fv;
+void AddrInfo::set_flags(Flags<AIFlag> fl){
+    _flags = fl;
     _reset_outvars();
 }
 
@@ -230,8 +390,8 @@ void AddrInfo::reset() {
     _reset_outvars();
 }
 
-// Convert (struct sockaddr)->ai_flags to a vector of our 'enum class AIFlag'
-std::vector<AIFlag> int_to_flags(int flags);
+// Convert (struct sockaddr)->ai_flags to our 'enum class AIFlag'
+Flags<AIFlag> int_to_flags(int flags);
 
 AddrInfo AddrInfo::from_struct(const struct addrinfo * p){
     auto af = to_enum<AddressFamily>(p->ai_family);
@@ -268,12 +428,12 @@ std::vector<AddrInfo> getAddrInfo(
 
     struct addrinfo *res = nullptr, hints = ai.to_hints();
 
-    std::cerr << "DEBUG: getaddrinfo with hints:\n" << ai << "\n";
+    UB_DEBUG("getaddrinfo with hints:\n" << ai);
     // Do lookup
     auto ret = getaddrinfo(h, s, &hints, &res);
 
     if(ret != 0){
-        std::cerr << gai_strerror(ret) << std::endl;
+        UB_WARN("getaddrinfo(): " << gai_strerror(ret));
         return v;
     }
 
@@ -289,41 +449,46 @@ std::vector<AddrInfo> getAddrInfo(const std::string & host, AddrInfo& hints, uin
     return getAddrInfo(host, hints, srv);
 }
 
-std::vector<AIFlag> int_to_flags(int flags) {
-    std::vector<AIFlag> fv;
-    for(unsigned i = 0; i < (sizeof(flags) * 8); ++i){
-        int mask =  (0x1 << i);
-        if(flags & mask){
-            auto f = to_enum<AIFlag>(mask);
-            if(!f){
-                std::cerr << "WARNING: skipping unrecognized AIFlag value: " << mask << std::endl;
-                continue;
-            }
-            fv.push_back(*f);
-            flags &= ~mask;
+Flags<AIFlag> int_to_flags(int flags) {
+    Flags<AIFlag> fl;
+    for(auto f : Flags<AIFlag>::from_value(flags)){
+        if(!to_integral(f)){
+            UB_WARN("skipping unrecognized AIFlag value: " << cpp::to_underlying(f));
+            continue;
         }
+        fl |= f;
     }
-    if(flags){
-        std::cerr
-            << "WARNING -AddrIinfoHint::flags(): Uknown ai_flags remaining:"
-            << flags << "\n";
-    }
-
-    std::sort(fv.begin(), fv.end());
-    return fv;
+    return fl;
 }
 
 // A lot of boilerplate, can we somehow merge these?
-Socket::Socket(const AddrInfo & info) :
-    Socket(info.family(), info.socket_type(), info.protocol())
+Socket::Socket(const AddrInfo & info, Flags<SocketFlag> fl) :
+    Socket(info.family(), info.socket_type(), info.protocol(), fl)
 {
 }
-Socket::Socket(AddressFamily af, SocketType st, Protocol pt) :
-    _sock(::socket(to_underlying(af), to_underlying(st), to_underlying(pt)))
+Socket::Socket(AddressFamily af, SocketType st, Protocol pt, Flags<SocketFlag> fl) :
+    _sock(::socket(to_underlying(af), to_underlying(st) | cpp::to_int(fl), to_underlying(pt)))
 {
     if(_sock < 0){ throw std::runtime_error(errno_str(errno)); }
     //std::cerr << "Opened socket: " << _sock << std::endl;
 }
+Maybe<std::pair<Socket, Socket>> Socket::socketpair(SocketType st, Flags<SocketFlag> fl){
+    int fds[2];
+    if(::socketpair(AF_UNIX, to_underlying(st) | cpp::to_int(fl), 0, fds) != 0){
+        return Nothing();
+    }
+    return std::make_pair(Socket(fds[0], _FromFd{}), Socket(fds[1], _FromFd{}));
+}
+
+Maybe<Socket> Socket::adopt(ReceivedFd && fd){
+    int type = 0;
+    socklen_t len = sizeof(type);
+    if(::getsockopt(fd.__fd(), SOL_SOCKET, SO_TYPE, &type, &len) != 0){
+        return Nothing();
+    }
+    return Socket(fd.release(), _FromFd{});
+}
+
 Socket::~Socket() {
     if(_sock > 0){
         //std::cerr << "Closing socket: " << _sock << "\n";
@@ -346,8 +511,7 @@ int Socket::bind(const AddrInfo & ai){
 int Socket::connect(const SockAddr & sa){
     int ret = ::connect(_sock, sa.addr(), sa.addrlen());
     if(ret < 0){
-        perror("connect()");
-        //std::cerr << "ERRROR: connect(): " << _unix::errno_str(errno) << std::endl;
+        UB_DEBUG("connect(): " << _unix::errno_str(errno));
     }
     return ret;
 }
@@ -363,7 +527,7 @@ int Socket::connect(const AddrInfo & ai){
 bool Socket::setblocking(bool blocking){
     int opts = fcntl(_sock, F_GETFL);
     if (opts < 0){
-		std::cerr << "ERROR: fcntl(F_GETFL): " << _unix::errno_str(errno) << "\n";
+		UB_ERROR("fcntl(F_GETFL): " << _unix::errno_str(errno));
 		return false;
     }
 
@@ -371,18 +535,441 @@ bool Socket::setblocking(bool blocking){
     opts = blocking ? (opts & ~O_NONBLOCK) : (opts | O_NONBLOCK);
 
     if(fcntl(_sock, F_SETFL, opts) < 0){
-        std::cerr << "ERROR: fcntl(F_SETFL): " << _unix::errno_str(errno) << "\n";
+        UB_ERROR("fcntl(F_SETFL): " << _unix::errno_str(errno));
 		return false;
     }
 
     return true;
 }
 
+int Socket::set_reuseaddr(bool on){
+    int val = on ? 1 : 0;
+    return setsockopt(SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+}
+
+int Socket::set_reuseport(bool on){
+    int val = on ? 1 : 0;
+    return setsockopt(SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val));
+}
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+
+int Socket::set_busy_poll(std::chrono::microseconds usecs){
+    int val = static_cast<int>(usecs.count());
+    return setsockopt(SOL_SOCKET, SO_BUSY_POLL, &val, sizeof(val));
+}
+int Socket::set_prefer_busy_poll(bool on){
+    int val = on ? 1 : 0;
+    return setsockopt(SOL_SOCKET, SO_PREFER_BUSY_POLL, &val, sizeof(val));
+}
+int Socket::set_busy_poll_budget(int packets){
+    return setsockopt(SOL_SOCKET, SO_BUSY_POLL_BUDGET, &packets, sizeof(packets));
+}
+
+
+namespace {
+// Common part of send_segmented()/sendto_segmented(). 'dest' may be null.
+ssize_t _sendmsg_gso(int sock, const uint8_t * buf, size_t len, uint16_t seg,
+                     const SockAddr * dest, int flags)
+{
+    struct iovec iov = {};
+    iov.iov_base = const_cast<uint8_t*>(buf);
+    iov.iov_len  = len;
+
+    // union for alignment, as advised in cmsg(3)
+    union {
+        char buf[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr align;
+    } ctrl = {};
+
+    struct msghdr mh = {};
+    mh.msg_iov        = &iov;
+    mh.msg_iovlen     = 1;
+    mh.msg_control    = ctrl.buf;
+    mh.msg_controllen = sizeof(ctrl.buf);
+    if(dest != nullptr){
+        mh.msg_name    = const_cast<struct sockaddr*>(dest->addr());
+        mh.msg_namelen = dest->addrlen();
+    }
+
+    auto * cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type  = UDP_SEGMENT;
+    cm->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+    memcpy(CMSG_DATA(cm), &seg, sizeof(seg));
+
+    return ::sendmsg(sock, &mh, flags);
+}
+} // anon ns
+
+ssize_t Socket::send_segmented(const uint8_t * buf, size_t len, uint16_t segment_size,
+                               Flags<SendFlag> fl)
+{
+    return _sendmsg_gso(_sock, buf, len, segment_size, nullptr, cpp::to_int(fl));
+}
+
+ssize_t Socket::sendto_segmented(const uint8_t * buf, size_t len, uint16_t segment_size,
+                                 const SockAddr & dest, Flags<SendFlag> fl)
+{
+    return _sendmsg_gso(_sock, buf, len, segment_size, &dest, cpp::to_int(fl));
+}
+
+int Socket::set_udp_segment(uint16_t segment_size){
+    int val = segment_size;
+    return setsockopt(SOL_UDP, UDP_SEGMENT, &val, sizeof(val));
+}
+
+int Socket::set_udp_gro(bool on){
+    int val = on ? 1 : 0;
+    return setsockopt(SOL_UDP, UDP_GRO, &val, sizeof(val));
+}
+
+GroRecv Socket::recvfrom_gro(uint8_t * buf, size_t buflen, Flags<RecvFlag> fl){
+    auto m = recvmsg(buf, buflen, fl);
+    return GroRecv{m.bytes, m.control.gro_segment_size().value_or(0), std::move(m.from)};
+}
+
+constexpr size_t ControlMessages::capacity;
+
+namespace {
+
+std::chrono::nanoseconds to_ns(const struct timespec & ts){
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+} // anon ns
+
+Maybe<uint16_t> ControlMessages::gro_segment_size() const {
+    auto seg = find<int>(SOL_UDP, UDP_GRO);
+    if(!seg){
+        return Nothing();
+    }
+    return static_cast<uint16_t>(*seg);
+}
+
+Maybe<Timestamp> ControlMessages::timestamp() const {
+    for(auto & cm : *this){
+        if(cm.cmsg_level != SOL_SOCKET){
+            continue;
+        }
+        if(cm.cmsg_type == SCM_TIMESTAMPNS){
+            auto ts = payload<struct timespec>(cm);
+            if(ts){
+                Timestamp t;
+                t.software = to_ns(*ts);
+                return t;
+            }
+        }
+        else if(cm.cmsg_type == SCM_TIMESTAMPING){
+            // ts[1] is unused (formerly "transformed" hardware time)
+            auto ts = payload<struct scm_timestamping>(cm);
+            if(ts){
+                Timestamp t;
+                t.software = to_ns(ts->ts[0]);
+                t.hardware = to_ns(ts->ts[2]);
+                return t;
+            }
+        }
+    }
+    return Nothing();
+}
+
+Maybe<struct sock_extended_err> ControlMessages::extended_error() const {
+    for(auto & cm : *this){
+        bool recverr = (cm.cmsg_level == SOL_IP   && cm.cmsg_type == IP_RECVERR)
+                    || (cm.cmsg_level == SOL_IPV6 && cm.cmsg_type == IPV6_RECVERR);
+        if(recverr){
+            return payload<struct sock_extended_err>(cm);
+        }
+    }
+    return Nothing();
+}
+
+Maybe<struct ucred> ControlMessages::credentials() const {
+    return find<struct ucred>(SOL_SOCKET, SCM_CREDENTIALS);
+}
+
+size_t ControlMessages::take_fds(std::vector<ReceivedFd> & out){
+    size_t n = 0;
+    for(auto & cm : *this){
+        if(cm.cmsg_level != SOL_SOCKET || cm.cmsg_type != SCM_RIGHTS){
+            continue;
+        }
+        // The buffer is ours: mark each descriptor taken by overwriting it
+        auto * p = const_cast<unsigned char*>(CMSG_DATA(&cm));
+        size_t count = (cm.cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for(size_t i = 0; i < count; ++i, p += sizeof(int)){
+            int fd;
+            memcpy(&fd, p, sizeof(fd));
+            if(fd < 0){
+                continue;
+            }
+            out.emplace_back(fd);
+            fd = -1;
+            memcpy(p, &fd, sizeof(fd));
+            ++n;
+        }
+    }
+    return n;
+}
+
+bool ControlMessages::add(int level, int type, const void * data, size_t len){
+    if(CMSG_SPACE(len) > capacity - _len){
+        return false;
+    }
+    // _len stays a multiple of the alignment, so the next header starts there
+    memset(_buf + _len, 0, CMSG_SPACE(len));
+    auto * cm = reinterpret_cast<struct cmsghdr*>(_buf + _len);
+    cm->cmsg_level = level;
+    cm->cmsg_type  = type;
+    cm->cmsg_len   = CMSG_LEN(len);
+    memcpy(CMSG_DATA(cm), data, len);
+    _len += CMSG_SPACE(len);
+    return true;
+}
+
+bool ControlMessages::add_fds(const int * fds, size_t n){
+    return add(SOL_SOCKET, SCM_RIGHTS, fds, n * sizeof(int));
+}
+
+bool ControlMessages::add_credentials(){
+    struct ucred c = {};
+    c.pid = ::getpid();
+    c.uid = ::getuid();
+    c.gid = ::getgid();
+    return add_credentials(c);
+}
+
+bool ControlMessages::add_credentials(const struct ucred & c){
+    return add(SOL_SOCKET, SCM_CREDENTIALS, &c, sizeof(c));
+}
+
+ReceivedFd::~ReceivedFd(){
+    if(_fd >= 0){
+        ::close(_fd);
+    }
+}
+
+RecvMsg Socket::recvmsg(uint8_t * buf, size_t buflen, Flags<RecvFlag> fl){
+    struct sockaddr_storage ss = {};
+    struct iovec iov = {};
+    iov.iov_base = buf;
+    iov.iov_len  = buflen;
+
+    RecvMsg r;
+    struct msghdr mh = {};
+    mh.msg_name       = &ss;
+    mh.msg_namelen    = sizeof(ss);
+    mh.msg_iov        = &iov;
+    mh.msg_iovlen     = 1;
+    mh.msg_control    = r.control._data();
+    mh.msg_controllen = ControlMessages::capacity;
+
+    r.bytes = ::recvmsg(_sock, &mh, cpp::to_int(fl));
+    if(r.bytes < 0){
+        return r;
+    }
+    r.flags = mh.msg_flags;
+    r.control._set_length(mh.msg_controllen);
+    if(mh.msg_namelen > 0){
+        r.from = SockAddr::from_struct(ss, mh.msg_namelen);
+    }
+    return r;
+}
+
+ssize_t Socket::sendmsg(const uint8_t * buf, size_t len, const ControlMessages & c, Flags<SendFlag> fl){
+    struct iovec iov = {};
+    iov.iov_base = const_cast<uint8_t*>(buf);
+    iov.iov_len  = len;
+
+    struct msghdr mh = {};
+    mh.msg_iov        = &iov;
+    mh.msg_iovlen     = 1;
+    mh.msg_control    = (c._length() > 0) ? const_cast<void*>(c._data()) : nullptr;
+    mh.msg_controllen = c._length();
+    return ::sendmsg(_sock, &mh, cpp::to_int(fl));
+}
+
+ssize_t Socket::sendmsg(const uint8_t * buf, size_t len, const ControlMessages & c, const SockAddr & dest,
+                        Flags<SendFlag> fl){
+    struct iovec iov = {};
+    iov.iov_base = const_cast<uint8_t*>(buf);
+    iov.iov_len  = len;
+
+    struct msghdr mh = {};
+    mh.msg_name       = const_cast<struct sockaddr*>(dest.addr());
+    mh.msg_namelen    = dest.addrlen();
+    mh.msg_iov        = &iov;
+    mh.msg_iovlen     = 1;
+    mh.msg_control    = (c._length() > 0) ? const_cast<void*>(c._data()) : nullptr;
+    mh.msg_controllen = c._length();
+    return ::sendmsg(_sock, &mh, cpp::to_int(fl));
+}
+
+int Socket::set_passcred(bool on){
+    int val = on ? 1 : 0;
+    return setsockopt(SOL_SOCKET, SO_PASSCRED, &val, sizeof(val));
+}
+
+Maybe<struct ucred> Socket::peer_credentials() const {
+    struct ucred c = {};
+    socklen_t len = sizeof(c);
+    if(::getsockopt(_sock, SOL_SOCKET, SO_PEERCRED, &c, &len) != 0){
+        return Nothing();
+    }
+    return c;
+}
+
+int Socket::set_timestamp_ns(bool on){
+    int val = on ? 1 : 0;
+    return setsockopt(SOL_SOCKET, SO_TIMESTAMPNS, &val, sizeof(val));
+}
+
+int Socket::set_timestamping(Flags<TimestampFlag> fl){
+    int val = cpp::to_int(fl);
+    return setsockopt(SOL_SOCKET, SO_TIMESTAMPING, &val, sizeof(val));
+}
+
+void ZeroCopyQueue::_push(Buffer && b, size_t sent){
+    _unsent = b.size() - sent;
+    _pending.push_back(Entry{_next_id++, false, std::move(b)});
+}
+
+void ZeroCopyQueue::_push_rest(size_t sent){
+    _unsent -= sent;
+    Buffer b = std::move(_pending.back().buf);
+    _pending.push_back(Entry{_next_id++, false, std::move(b)});
+}
+
+void ZeroCopyQueue::_complete(uint32_t lo, uint32_t hi, bool copied){
+    _copied = copied;
+    // Ids are 32-bit and wrap around; compare distances instead of values
+    for(auto & e : _pending){
+        if(e.id - lo <= hi - lo){
+            e.done = true;
+        }
+    }
+    // Hand back in send order
+    while(!_pending.empty() && _pending.front().done){
+        // Empty for the earlier parts of a buffer sent in several goes
+        if(!_pending.front().buf.empty()){
+            _done.push_back(std::move(_pending.front().buf));
+        }
+        _pending.pop_front();
+    }
+}
+
+size_t ZeroCopyQueue::take_completed(std::vector<Buffer> & out){
+    size_t n = _done.size();
+    for(auto & b : _done){
+        out.push_back(std::move(b));
+    }
+    _done.clear();
+    return n;
+}
+
+int Socket::set_zerocopy(bool on){
+    int val = on ? 1 : 0;
+    return setsockopt(SOL_SOCKET, SO_ZEROCOPY, &val, sizeof(val));
+}
+
+ssize_t Socket::send_zerocopy(ZeroCopyQueue & q, ZeroCopyQueue::Buffer && buf,
+                              Flags<SendFlag> fl)
+{
+    if(q.unsent() > 0){
+        errno = EINVAL;     // the rest of the previous buffer has to go first
+        return -1;
+    }
+    auto ret = ::send(_sock, buf.data(), buf.size(), cpp::to_int(fl) | MSG_ZEROCOPY);
+    // Only a send that moved data is counted by the kernel
+    if(ret > 0){
+        q._push(std::move(buf), ret);
+    }
+    return ret;
+}
+
+ssize_t Socket::send_zerocopy_rest(ZeroCopyQueue & q, Flags<SendFlag> fl){
+    if(q.unsent() == 0){
+        return 0;
+    }
+    auto ret = ::send(_sock, q._rest(), q.unsent(), cpp::to_int(fl) | MSG_ZEROCOPY);
+    if(ret > 0){
+        q._push_rest(ret);
+    }
+    return ret;
+}
+
+ssize_t Socket::sendto_zerocopy(ZeroCopyQueue & q, ZeroCopyQueue::Buffer && buf, const SockAddr & dest,
+                                Flags<SendFlag> fl)
+{
+    auto ret = ::sendto(_sock, buf.data(), buf.size(), cpp::to_int(fl) | MSG_ZEROCOPY,
+                        dest.addr(), dest.addrlen());
+    if(ret > 0){
+        q._push(std::move(buf), ret);
+    }
+    return ret;
+}
+
+int Socket::reap_zerocopy(ZeroCopyQueue & q){
+    return _reap_error_queue(&q, nullptr);
+}
+
+int Socket::reap_tx_timestamps(std::vector<TxTimestamp> & out){
+    return _reap_error_queue(nullptr, &out);
+}
+
+int Socket::reap_error_queue(ZeroCopyQueue & q, std::vector<TxTimestamp> & out){
+    return _reap_error_queue(&q, &out);
+}
+
+int Socket::_reap_error_queue(ZeroCopyQueue * q, std::vector<TxTimestamp> * out){
+    int count = 0;
+    while(true){
+        // Without OptTsOnly, TX timestamps carry a copy of the packet. It is not
+        // needed, so let it be truncated.
+        ControlMessages ctrl;
+        struct msghdr mh = {};
+        mh.msg_control    = ctrl._data();
+        mh.msg_controllen = ControlMessages::capacity;
+
+        if(::recvmsg(_sock, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0){
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                return count;
+            }
+            return -1;
+        }
+        ctrl._set_length(mh.msg_controllen);
+
+        auto ee = ctrl.extended_error();
+        if(!ee){
+            continue;
+        }
+        if(ee->ee_origin == SO_EE_ORIGIN_ZEROCOPY && ee->ee_errno == 0){
+            if(q){
+                q->_complete(ee->ee_info, ee->ee_data, ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+                ++count;
+            }
+        }
+        else if(ee->ee_origin == SO_EE_ORIGIN_TIMESTAMPING && ee->ee_errno == ENOMSG){
+            auto ts = ctrl.timestamp();
+            if(out && ts){
+                out->push_back(TxTimestamp{static_cast<TxStamp>(ee->ee_info), ee->ee_data, *ts});
+                ++count;
+            }
+        }
+    }
+}
 
 // a.k.a "passive" socket
 Maybe<Socket> server_socket_udp(
     const std::string & laddr,
-    const std::string & service
+    const std::string & service,
+    bool reuseport
 )
 {
     AddrInfo hints(AddressFamily::Any, SocketType::Datagram, Protocol::UDP);
@@ -392,25 +979,26 @@ Maybe<Socket> server_socket_udp(
     const auto aiv = getAddrInfo(laddr, hints, service);
 
     for(const auto & ai : aiv){
-        std::cerr << "DEBUG: server_socket got ai:\n";
-        std::cout << ai << std::endl;
+        UB_DEBUG("server_socket got ai:\n" << ai);
         try {
             Socket s(ai);
+            if(reuseport && s.set_reuseport(true) != 0){
+                UB_ERROR("setsockopt(SO_REUSEPORT): " << _unix::errno_str(errno));
+                continue;
+            }
             int ret = s.bind(ai);
             if(ret != 0){
-                std::cerr << "ERROR bind(): " << _unix::errno_str(errno) << std::endl;
+                UB_ERROR("bind(): " << _unix::errno_str(errno));
                 continue;
             }
-            return std::move(s);
+            return s;
         }
         catch (std::runtime_error & e){
-            std::cerr << "server_socket_udp creation failed: " <<  e.what() << std::endl;
+            UB_ERROR("server_socket_udp creation failed: " << e.what());
             continue;
         }
     }
-    std::cerr
-        << "ERROR: could not create socket for '"
-        << laddr << ":" << service << "'" << std::endl;
+    UB_ERROR("could not create socket for '" << laddr << ":" << service << "'");
     return Nothing();
 }
 
@@ -418,12 +1006,196 @@ int Socket::listen(int backlog){
     return ::listen(_sock, backlog);
 }
 
+Maybe<Connection> Socket::accept(Flags<SocketFlag> fl){
+    struct sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    int fd = ::accept4(_sock, reinterpret_cast<struct sockaddr*>(&ss), &len, cpp::to_int(fl));
+    if(fd < 0){
+        return Nothing();
+    }
+    return Connection{Socket(fd, _FromFd{}), SockAddr::from_struct(ss, len, false)};
+}
+
+ssize_t Socket::sendfile(int fd, off_t & offset, size_t count){
+    return ::sendfile(_sock, fd, &offset, count);
+}
+
+Transfer Socket::sendfile_all(int fd, off_t & offset, size_t count){
+    Transfer t;
+    while(t.bytes < count){
+        auto n = ::sendfile(_sock, fd, &offset, count - t.bytes);
+        if(n > 0){
+            t.bytes += n;
+        }
+        else if(n == 0){
+            t.eof = true;
+            break;
+        }
+        else if(errno == EINTR){
+            continue;
+        }
+        else {
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                t.again = true;
+            }
+            else {
+                t.error = errno;
+            }
+            break;
+        }
+    }
+    return t;
+}
+
+Transfer Socket::splice_all(int fd, off_t & offset, size_t count, Pipe & p,
+                            Flags<SpliceFlag> fl)
+{
+    Transfer t;
+
+    // Left over from a previous call that stopped on EAGAIN
+    int buffered = p.size();
+    if(buffered < 0){
+        t.error = errno;
+        return t;
+    }
+    size_t pending = buffered;
+
+    const int flags = cpp::to_int(fl);
+    while(t.bytes < count){
+        if(pending == 0){
+            loff_t off = offset;
+            auto n = ::splice(fd, &off, p.write_fd(), nullptr, count - t.bytes, flags & ~SPLICE_F_MORE);
+            if(n > 0){
+                offset = off;
+                pending = n;
+            }
+            else if(n == 0){
+                t.eof = true;
+                break;
+            }
+            else if(errno == EINTR){
+                continue;
+            }
+            else {
+                t.error = errno;
+                break;
+            }
+        }
+
+        const bool more = t.bytes + pending < count;
+        auto n = ::splice(p.read_fd(), nullptr, _sock, nullptr, pending, flags | (more ? SPLICE_F_MORE : 0));
+        if(n > 0){
+            pending -= n;
+            t.bytes += n;
+        }
+        else if(n < 0 && errno == EINTR){
+            continue;
+        }
+        else {
+            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+                t.again = true;
+            }
+            else {
+                t.error = (n < 0) ? errno : EPIPE;
+            }
+            break;
+        }
+    }
+    return t;
+}
+
+int Socket::set_defer_accept(int seconds){
+    return setsockopt(IPPROTO_TCP, TCP_DEFER_ACCEPT, &seconds, sizeof(seconds));
+}
+
+int Socket::set_nodelay(bool on){
+    int v = on ? 1 : 0;
+    return setsockopt(IPPROTO_TCP, TCP_NODELAY, &v, sizeof(v));
+}
+
+Maybe<Socket> server_socket_tcp(
+    const std::string & laddr,
+    const std::string & service,
+    int backlog,
+    bool reuseport,
+    int defer_accept
+)
+{
+    AddrInfo hints(AddressFamily::Any, SocketType::Stream, Protocol::TCP);
+
+    hints.set_flag(AIFlag::Passive);
+
+    const auto aiv = getAddrInfo(laddr, hints, service);
+
+    for(const auto & ai : aiv){
+        UB_DEBUG("server_socket_tcp got ai:\n" << ai);
+        try {
+            Socket s(ai, {SocketFlag::NonBlock, SocketFlag::CloseOnExec});
+            if(s.set_reuseaddr(true) != 0){
+                UB_ERROR("setsockopt(SO_REUSEADDR): " << _unix::errno_str(errno));
+                continue;
+            }
+            if(reuseport && s.set_reuseport(true) != 0){
+                UB_ERROR("setsockopt(SO_REUSEPORT): " << _unix::errno_str(errno));
+                continue;
+            }
+            if(defer_accept > 0 && s.set_defer_accept(defer_accept) != 0){
+                UB_ERROR("setsockopt(TCP_DEFER_ACCEPT): " << _unix::errno_str(errno));
+                continue;
+            }
+            if(s.bind(ai) != 0){
+                UB_ERROR("bind(): " << _unix::errno_str(errno));
+                continue;
+            }
+            if(s.listen(backlog) != 0){
+                UB_ERROR("listen(): " << _unix::errno_str(errno));
+                continue;
+            }
+            return s;
+        }
+        catch (std::runtime_error & e){
+            UB_ERROR("server_socket_tcp creation failed: " << e.what());
+            continue;
+        }
+    }
+    UB_ERROR("could not create socket for '" << laddr << ":" << service << "'");
+    return Nothing();
+}
+
+Maybe<Socket> client_socket_tcp(
+    const std::string & raddr,
+    const std::string & service
+)
+{
+    AddrInfo hints(AddressFamily::Any, SocketType::Stream, Protocol::TCP);
+
+    const auto aiv = getAddrInfo(raddr, hints, service);
+
+    for(const auto & ai : aiv){
+        UB_DEBUG("client_socket_tcp got ai:\n" << ai);
+        try {
+            Socket s(ai, {SocketFlag::CloseOnExec});
+            if(s.connect(ai) != 0){
+                UB_ERROR("connect(): " << _unix::errno_str(errno));
+                continue;
+            }
+            return s;
+        }
+        catch (std::runtime_error & e){
+            UB_ERROR("client_socket_tcp creation failed: " << e.what());
+            continue;
+        }
+    }
+    UB_ERROR("could not create socket for '" << raddr << ":" << service << "'");
+    return Nothing();
+}
+
 Maybe<SockAddr> Socket::getsockname() const {
 	struct sockaddr_storage ss;
 	socklen_t len = sizeof(ss);
 	auto ret = ::getsockname(_sock, reinterpret_cast<struct sockaddr*>(&ss), &len);
 	if(ret < 0){
-		std::cerr << "ERROR getsockname(): " << _unix::errno_str(errno) << std::endl;
+		UB_ERROR("getsockname(): " << _unix::errno_str(errno));
 		return Nothing();
 	}
 	return SockAddr::from_struct(ss, len, false);
@@ -433,7 +1205,7 @@ Maybe<SockAddr> Socket::getpeername() const {
 	socklen_t len = sizeof(ss);
 	int ret = ::getpeername(_sock, reinterpret_cast<struct sockaddr*>(&ss), &len);
 	if(ret < 0){
-		std::cerr << "ERROR getpeername(): " << _unix::errno_str(errno) << std::endl;
+		UB_ERROR("getpeername(): " << _unix::errno_str(errno));
 		return Nothing();
 	}
 	return SockAddr::from_struct(ss, len, false);
@@ -451,30 +1223,112 @@ Maybe<Socket> client_socket_udp(
     const auto aiv = getAddrInfo(raddr, hints, service);
 
     for(const auto & ai : aiv){
-        std::cerr << "----\n";
-        std::cerr << "DEBUG: client_socket got ai:\n";
-        std::cout << ai << std::endl;
+        UB_DEBUG("client_socket got ai:\n" << ai);
         try {
             Socket s(ai);
             int ret = s.connect(ai);
             if(ret != 0){
-                std::cerr << "ERROR connect(): " << _unix::errno_str(errno) << std::endl;
+                UB_ERROR("connect(): " << _unix::errno_str(errno));
                 continue;
             }
-            return std::move(s);
+            return s;
         }
         catch (std::runtime_error & e){
-            std::cerr << "client_socket_any creation failed: " <<  e.what() << std::endl;
+            UB_ERROR("client_socket_udp creation failed: " << e.what());
             continue;
         }
     }
-    std::cerr
-        << "ERROR: could not create socket for '"
-        << raddr << ":" << service << "'" << std::endl;
+    UB_ERROR("could not create socket for '" << raddr << ":" << service << "'");
 
     return Nothing();
 }
 
+namespace {
+// True if 'path' is a socket file nobody is listening on (left by a crashed server)
+bool _stale_unix_socket(const SockAddr & sa, SocketType st){
+    struct stat sb;
+    auto * un = reinterpret_cast<const struct sockaddr_un*>(sa.addr());
+    if(::lstat(un->sun_path, &sb) != 0 || !S_ISSOCK(sb.st_mode)){
+        return false;
+    }
+    try {
+        Socket probe(AddressFamily::Unix, st, Protocol::Any, {SocketFlag::CloseOnExec});
+        return probe.connect(sa) != 0 && errno == ECONNREFUSED;
+    }
+    catch (std::runtime_error &){
+        return false;
+    }
+}
+} // anon ns
+
+Maybe<Socket> server_socket_unix(
+    const SockAddr & local,
+    SocketType st,
+    int backlog
+)
+{
+    if(local.family() != AddressFamily::Unix){
+        UB_ERROR("server_socket_unix: not an AF_UNIX address");
+        errno = EAFNOSUPPORT;
+        return Nothing();
+    }
+    try {
+        Socket s(AddressFamily::Unix, st, Protocol::Any, {SocketFlag::CloseOnExec});
+        int ret = s.bind(local);
+        if(ret != 0 && errno == EADDRINUSE && !local.is_abstract() && _stale_unix_socket(local, st)){
+            auto * un = reinterpret_cast<const struct sockaddr_un*>(local.addr());
+            UB_INFO("replacing stale socket file " << un->sun_path);
+            ::unlink(un->sun_path);
+            ret = s.bind(local);
+        }
+        if(ret != 0){
+            UB_ERROR("bind(): " << _unix::errno_str(errno));
+            return Nothing();
+        }
+        if(st != SocketType::Datagram && s.listen(backlog) != 0){
+            UB_ERROR("listen(): " << _unix::errno_str(errno));
+            return Nothing();
+        }
+        return s;
+    }
+    catch (std::runtime_error & e){
+        UB_ERROR("server_socket_unix creation failed: " << e.what());
+        return Nothing();
+    }
+}
+
+Maybe<Socket> client_socket_unix(
+    const SockAddr & remote,
+    SocketType st
+)
+{
+    if(remote.family() != AddressFamily::Unix){
+        UB_ERROR("client_socket_unix: not an AF_UNIX address");
+        errno = EAFNOSUPPORT;
+        return Nothing();
+    }
+    try {
+        Socket s(AddressFamily::Unix, st, Protocol::Any, {SocketFlag::CloseOnExec});
+        if(st == SocketType::Datagram){
+            // Binding just the family autobinds to a unique abstract name
+            sa_family_t fam = AF_UNIX;
+            auto sa = SockAddr::from_struct(reinterpret_cast<struct sockaddr*>(&fam), sizeof(fam), false);
+            if(s.bind(*sa) != 0){
+                UB_ERROR("bind(): " << _unix::errno_str(errno));
+                return Nothing();
+            }
+        }
+        if(s.connect(remote) != 0){
+            UB_ERROR("connect(): " << _unix::errno_str(errno));
+            return Nothing();
+        }
+        return s;
+    }
+    catch (std::runtime_error & e){
+        UB_ERROR("client_socket_unix creation failed: " << e.what());
+        return Nothing();
+    }
+}
 
 std::ostream & operator<<(std::ostream & os, const _unix::inet::AddrInfo & a){
     os << a.to_string();
@@ -484,6 +1338,9 @@ std::ostream & operator<<(std::ostream & os, const _unix::inet::SockAddr & a){
     os << a.to_string();
 	return os;
 }
+std::ostream & operator<<(std::ostream & os, const _unix::inet::PeerAddr & a){
+    return os << a.to_sockaddr().endpoint();
+}
 
 Maybe<SockAddr> SockAddr::from_struct(const struct sockaddr_storage & ss, socklen_t len, bool verify){
     if(!verify){
@@ -494,7 +1351,7 @@ Maybe<SockAddr> SockAddr::from_struct(const struct sockaddr_storage & ss, sockle
     }
     auto fam = ss.ss_family;
     auto f = AddressFamilyCheck::to_enum(fam);
-    if(!f && *f == AddressFamily::Any){
+    if(!f || *f == AddressFamily::Any){
         return Nothing();
     }
     return SockAddr(ss, len);
@@ -0,0 +1,263 @@
+#include <pthread.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <unix/log.hpp>
+
+namespace _unix {
+
+namespace log {
+
+constexpr size_t Record::max_len;
+
+const char * level_name(Level l){
+    switch(l){
+        case Level::Debug:   return "DEBUG";
+        case Level::Info:    return "INFO";
+        case Level::Warning: return "WARNING";
+        case Level::Error:   return "ERROR";
+        case Level::Off:     return "OFF";
+    }
+    return "?";
+}
+
+namespace {
+
+struct Entry {
+    Level    level;
+    uint16_t len;
+    char     text[Record::max_len];
+};
+
+// Single producer (the owning thread), single consumer (the drain thread)
+struct Ring {
+    static constexpr size_t size = 256;
+
+    alignas(64) std::atomic<size_t> head{0};    // consumer
+    alignas(64) std::atomic<size_t> tail{0};    // producer
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<bool>     orphaned{false};      // owning thread has exited
+    Entry                 entries[size];
+
+    bool push(Level l, const char * text, size_t len){
+        size_t t = tail.load(std::memory_order_relaxed);
+        if(t - head.load(std::memory_order_acquire) == size){
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        auto & e = entries[t % size];
+        e.level = l;
+        e.len   = len;
+        memcpy(e.text, text, len);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+};
+
+class Logger {
+public:
+    Logger() : _idle(false), _quit(false), _flushes(0) {
+        // The drain thread must not steal signals from the application
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        _thread = std::thread([this]{ _run(); });
+        pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    }
+    ~Logger(){
+        {
+            std::lock_guard<std::mutex> g(_lock);
+            _quit = true;
+        }
+        _cv.notify_all();
+        _thread.join();
+    }
+
+    void attach(const std::shared_ptr<Ring> & r){
+        std::lock_guard<std::mutex> g(_lock);
+        _rings.push_back(r);
+    }
+
+    void flush(){
+        std::unique_lock<std::mutex> g(_lock);
+        auto target = ++_flushes;
+        _cv.notify_all();
+        _flushed.wait(g, [&]{ return _done_flushes >= target || _quit; });
+    }
+
+    // After a push: wake the drain thread if it has gone to sleep. The counterpart
+    // of the re-check in _sleep(); with full fences on both sides, either it sees
+    // the new entry or we see it idle.
+    void wake(){
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(_idle.load(std::memory_order_relaxed) && _idle.exchange(false)){
+            // Taking the lock orders us after its predicate check, so the
+            // notification cannot fall in between and get lost
+            { std::lock_guard<std::mutex> g(_lock); }
+            _cv.notify_one();
+        }
+    }
+
+    static Logger & instance(){
+        static Logger l;
+        return l;
+    }
+
+    static std::atomic<bool> alive;
+
+private:
+    void _drain_all(){
+        std::vector<std::shared_ptr<Ring>> rings;
+        {
+            std::lock_guard<std::mutex> g(_lock);
+            rings = _rings;
+        }
+        for(auto & r : rings){
+            _drain(*r);
+        }
+        // Forget rings of exited threads once they are empty
+        std::lock_guard<std::mutex> g(_lock);
+        for(size_t i = 0; i < _rings.size(); ){
+            if(_rings[i]->orphaned.load() && _rings[i]->empty()){
+                _rings[i] = _rings.back();
+                _rings.pop_back();
+            }
+            else {
+                ++i;
+            }
+        }
+    }
+
+    static void _drain(Ring & r){
+        size_t h = r.head.load(std::memory_order_relaxed);
+        size_t t = r.tail.load(std::memory_order_acquire);
+        for(; h != t; ++h){
+            const auto & e = r.entries[h % Ring::size];
+            fprintf(stderr, "%s: %.*s\n", level_name(e.level), int(e.len), e.text);
+        }
+        r.head.store(h, std::memory_order_release);
+
+        auto d = r.dropped.exchange(0, std::memory_order_relaxed);
+        if(d > 0){
+            fprintf(stderr, "WARNING: log ring full, %llu messages dropped\n",
+                    static_cast<unsigned long long>(d));
+        }
+    }
+
+    bool _all_empty(){
+        std::lock_guard<std::mutex> g(_lock);
+        for(auto & r : _rings){
+            if(!r->empty()){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Block until a producer, flush() or the destructor wakes us up
+    void _sleep(){
+        _idle.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(!_all_empty()){
+            _idle.store(false, std::memory_order_relaxed);
+            return;
+        }
+        std::unique_lock<std::mutex> g(_lock);
+        _cv.wait(g, [this]{
+            return _quit || _flushes != _done_flushes || !_idle.load(std::memory_order_relaxed);
+        });
+        _idle.store(false, std::memory_order_relaxed);
+    }
+
+    void _run(){
+        while(true){
+            uint64_t flushes;
+            bool quit;
+            {
+                std::lock_guard<std::mutex> g(_lock);
+                flushes = _flushes;
+                quit = _quit;
+            }
+            _drain_all();
+            fflush(stderr);
+            {
+                std::lock_guard<std::mutex> g(_lock);
+                _done_flushes = flushes;
+            }
+            _flushed.notify_all();
+            if(quit){
+                alive = false;
+                return;
+            }
+            _sleep();
+        }
+    }
+
+    std::mutex                          _lock;
+    std::condition_variable             _cv;
+    std::condition_variable             _flushed;
+    std::vector<std::shared_ptr<Ring>>  _rings;
+    std::atomic<bool>                   _idle;     // drain thread is (about to be) asleep
+    bool                                _quit;
+    uint64_t                            _flushes;
+    uint64_t                            _done_flushes = 0;
+    std::thread                         _thread;
+};
+
+std::atomic<bool> Logger::alive{true};
+
+// Per-thread ring, registered with the Logger on first use
+struct LocalRing {
+    LocalRing() : ring(std::make_shared<Ring>()) {
+        Logger::instance().attach(ring);
+    }
+    ~LocalRing(){
+        ring->orphaned = true;
+    }
+    std::shared_ptr<Ring> ring;
+};
+
+} // anon ns
+
+Record::~Record(){
+    // Callers often log right before returning -1, keep their errno intact
+    int saved_errno = errno;
+    size_t len = _buf.size();
+    if(_buf.full() && len >= 3){
+        memcpy(_text + len - 3, "...", 3);
+    }
+    if(!Logger::alive){
+        // Static destruction has already taken the drain thread down
+        fprintf(stderr, "%s: %.*s\n", level_name(_level), int(len), _text);
+    }
+    else {
+        static thread_local LocalRing local;
+        if(local.ring->push(_level, _text, len)){
+            Logger::instance().wake();
+        }
+    }
+    errno = saved_errno;
+}
+
+void flush(){
+    if(Logger::alive){
+        Logger::instance().flush();
+    }
+}
+
+} // ns log
+
+} // ns _unix
@@ -9,6 +9,9 @@
 #include <unix/signals.hpp>
 
 #include <unix/epoll.hpp>
+#include <unix/sharded.hpp>
+
+#include <thread>
 
 // Kinda like in python you say "import Foo as bar'
 namespace unix = _unix;
@@ -20,47 +23,124 @@ void signalHandler(int w_sig __attribute__ ((unused)))
     run = false;
 }
 
-void handle_in(unix::inet::Socket & s){
-    uint8_t buf[9000];
-
-    auto p = s.recvfrom(buf, sizeof(buf), {});
+// Number of datagrams handled per recvmmsg/sendmmsg call
+constexpr size_t batch_size = 16;
+constexpr size_t max_datagram = 9000;
 
-    ssize_t n = p.first;
-    std::cout << "Receive return: " << n << std::endl;
+using Batch = unix::inet::MsgBatch<batch_size>;
 
-    if(n < 0){
-        std::cerr << "recv(): " << unix::errno_str(errno) << std::endl;
+// A batch whose slots are backed by buffers from a shared pool
+struct PooledBatch {
+    PooledBatch(unix::BufferPool & pool) {
+        for(size_t i = 0; i < batch_size; ++i){
+            bufs[i] = pool.acquire();
+            if(!bufs[i]){
+                throw std::runtime_error("buffer pool exhausted");
+            }
+            batch.set_buffer(i, bufs[i]);
+        }
     }
+    std::array<unix::PoolBuffer, batch_size> bufs;
+    Batch batch;
+};
+
+// Edge triggered: keep receiving until the socket is drained.
+void handle_in(unix::inet::Socket & s, Batch & batch){
+    using unix::inet::RecvFlag;
+    using unix::inet::SendFlag;
+    using unix::inet::MsgFlag;
+
+    while(true){
+        int n = s.recvmmsg(batch, {RecvFlag::DontWait});
+        std::cout << "Receive return: " << n << std::endl;
+
+        if(n < 0){
+            if(errno != EAGAIN && errno != EWOULDBLOCK){
+                std::cerr << "recvmmsg(): " << unix::errno_str(errno) << std::endl;
+            }
+            break;
+        }
 
-    else{
-        std::cerr << "from:  " << *p.second << std::endl;
-        std::cerr << "bytes: " << n << std::endl;
-        std::cerr << "data:  " << std::string((const char*)buf, n) << "\n";
-        std::reverse(std::begin(buf), std::begin(buf)+n-1);
-
-        ssize_t n2 = s.sendto(buf, n, *p.second, {unix::inet::SendFlag::DontWait});
-
-        if(n2 < 0){
-            std::cerr << "sendto(): " << unix::errno_str(errno) << std::endl;
+        for(int i = 0; i < n; ++i){
+            auto len = batch.length(i);
+            auto * buf = batch.data(i);
+            auto from = batch.address(i);
+            if(from){
+                std::cerr << "from:  " << from->endpoint() << "\n";
+            }
+            std::cerr << "bytes: " << len << std::endl;
+            if(batch.has_flag(i, MsgFlag::Truncated)){
+                std::cerr << "WARNING: datagram truncated\n";
+            }
+            std::cerr << "data:  " << std::string((const char*)buf, len) << "\n";
+            if(len > 1){
+                std::reverse(buf, buf+len-1);
+            }
         }
-        if(n2 != n){
-            std::cerr << "omg sendto has problems, gosh: " << std::to_string(n2) << "\n";
+
+        // Echo the batch back to the senders; source addresses double as destinations
+        size_t sent = 0;
+        while(sent < batch.size()){
+            int n2 = s.sendmmsg(batch, sent, {SendFlag::DontWait});
+            if(n2 < 0){
+                std::cerr << "sendmmsg(): " << unix::errno_str(errno) << std::endl;
+                break;
+            }
+            if(static_cast<size_t>(n2) != batch.size() - sent){
+                std::cerr << "partial sendmmsg, retrying rest: " << std::to_string(n2) << "\n";
+            }
+            sent += n2;
         }
+        std::cerr << "---\n";
+    }
+}
+
+// One SO_REUSEPORT socket and thread per shard
+int sharded_server(const std::string & h, const std::string & srv, size_t n_shards){
+    // Before the shard threads exist, so that they inherit the blocked mask
+    unix::signals::SignalFd sigs({unix::signals::Signal::Interrupt, unix::signals::Signal::Terminate},
+                                 {unix::signals::SignalFdFlag::CloseOnExec});
+
+    unix::BufferPool pool(max_datagram, n_shards * batch_size);
+    std::vector<std::unique_ptr<PooledBatch>> state;
+    for(size_t i = 0; i < n_shards; ++i){
+        state.emplace_back(new PooledBatch(pool));
     }
-    std::cerr << "---\n";
 
+    unix::inet::ShardedUdpServer server(h, srv,
+        [&state](unix::inet::Socket & s, size_t shard){
+            handle_in(s, state[shard]->batch);
+        },
+        n_shards, true);
+
+    std::cout << "started " << server.size() << " shards" << std::endl;
+    server.start();
+
+    // Blocking read, nothing else to do meanwhile
+    if(auto si = sigs.read()){
+        std::cerr << "got signal " << si->signo() << " from pid " << si->pid() << "\n";
+    }
+    server.stop();
+    std::cerr << "Exiting...";
+    return 0;
 }
 
 int server(int argc, const char* argv[]){
 
     if(argc < 3){
-        std::cerr << "usage: <address or name> <port>\n";
+        std::cerr << "usage: <address or name> <port> [shards]\n";
         return -1;
     }
 
     auto h   = std::string(argv[1]);
     auto srv = std::string(argv[2]);
 
+    using unix::signals::Signal;
+
+    if(argc >= 4){
+        return sharded_server(h, srv, std::stoul(argv[3]));
+    }
+
 
     auto _s = unix::inet::server_socket_udp(h, srv);
 
@@ -81,51 +161,52 @@ int server(int argc, const char* argv[]){
 
     using namespace _unix::epoll;
 
-    auto epoll = Epoll();
-
-    // this data can be anything.
-    // NOTE: later in the loop, you will receive a bunch of epoll_event structs.
-    // These will have the union value filled in, but you have no way of knowing which one it is,
-    // other that just "knowing" in advance...
-
-
-    uint32_t stream_number_1 = 0x123;
-
-    // for example:
-    std::map<int, EpollUserData> input_map;
-    input_map[s.__fd()].set_u32(stream_number_1);
-
-    // epoll_add[streams[0].fd()].set_u32(streams[0].streamno())
-    // input_map[streams[1].fd()].set_u32(streams[1].streamno())
-    // ..later...
-    // for(...)
-    //      streams[evts[i].data.u32].recv(...)
-
-    epoll.add(s, {EpollEventType::Input, EpollEventType::EdgeTrigger}, input_map[s.__fd()]);
-
-    using namespace std::chrono_literals;
-
-    while(run){
-        //std::cerr << "DEBUG: waiting..\n";
-        EventList<10> evts;
-        auto n_ev = epoll.wait(evts, 500ms);
-        if(n_ev < 0){
-            // TODO: could be a non-error value, such as timeout expiration
-            std::cerr << "ERROR - Epoll::wait(): " << unix::errno_str(errno) << std::endl;;
-            break;
-        }
-        if(n_ev > 0){
-            std::cerr << "epoll_wait returned: " << n_ev << std::endl;
-        }
-        for(int i = 0; i < n_ev; ++i){
-            if(evts[i].matches_u32(stream_number_1) && (evts[i] & EpollEventType::Input)){
-                handle_in(s);
+    // The handler object is registered directly with the loop; its address comes
+    // back in the epoll event, so no fd -> stream lookups are needed.
+    class EchoHandler : public EventHandler {
+    public:
+        EchoHandler(unix::inet::Socket & s, unix::BufferPool & pool) : _s(s), _pb(pool) { }
+        void on_event(const EpollEvent & ev) override {
+            if(ev & EpollEventType::Input){
+                handle_in(_s, _pb.batch);
             }
             else{
-                std::cerr << "Unknown socket or event type" << std::endl;
+                std::cerr << "Unknown event type" << std::endl;
+            }
+        }
+    private:
+        unix::inet::Socket & _s;
+        PooledBatch _pb;
+    };
+
+    // Signals arrive as events, so the loop can block indefinitely
+    class Signals : public SignalHandler {
+    public:
+        Signals(unix::signals::SignalFd & sfd, EventLoop<256> & loop) : SignalHandler(sfd), _loop(loop) { }
+        void on_signal(const unix::signals::SignalInfo & si) override {
+            auto sig = si.signal();
+            std::cerr << "got " << (sig ? unix::signals::to_string(*sig) : std::to_string(si.signo()))
+                      << " from pid " << si.pid() << "\n";
+            if(sig && *sig != Signal::User1){
+                _loop.stop();
             }
         }
+    private:
+        EventLoop<256> & _loop;
+    };
+
+    EventLoop<256> loop;
+    unix::BufferPool pool(max_datagram, batch_size);
+    EchoHandler echo(s, pool);
+
+    unix::signals::SignalFd sfd({Signal::Interrupt, Signal::Terminate, Signal::User1});
+    Signals sig(sfd, loop);
+
+    loop.add(s, echo, {EpollEventType::Input, EpollEventType::EdgeTrigger});
+    loop.add(sig);
 
+    if(loop.run() < 0){
+        std::cerr << "ERROR - EventLoop::run(): " << unix::errno_str(errno) << std::endl;
     }
 	std::cerr << "Exiting...";
     return 0;
@@ -140,6 +221,11 @@ int client(int argc, const char* argv[]){
 	auto h   = std::string(argv[1]);
 	auto srv = std::string(argv[2]);
 
+	if(unix::signals::handleInterrupt(signalHandler) < 0){
+		std::cerr << "handleInterrupt() failed, exiting..\n";
+		return -1;
+	}
+
 	auto _s = unix::inet::client_socket_udp(h, srv);
 
 	if(!_s){
@@ -177,11 +263,6 @@ int client(int argc, const char* argv[]){
 
 int main(int argc, const char *argv[])
 {
-	if(unix::signals::handleInterrupt(signalHandler) < 0){
-		std::cerr << "handleInterrupt() failed, exiting..\n";
-		exit(1);
-	}
-
     std::string progname(argv[0]);
 
     std::cout << "progname: " << progname << std::endl;
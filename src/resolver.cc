@@ -0,0 +1,175 @@
+#include <pthread.h>
+#include <csignal>
+
+#include <unix/resolver.hpp>
+
+namespace _unix {
+
+namespace inet {
+
+Resolver::Resolver(Seconds ttl, size_t workers, size_t max_entries)
+: _ttl(ttl), _max_entries(std::max<size_t>(max_entries, 1)), _quit(false)
+{
+    // Keep signals out of the worker threads
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for(size_t i = 0; i < std::max<size_t>(workers, 1); ++i){
+        _workers.emplace_back([this]{ _work(); });
+    }
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+}
+
+Resolver::~Resolver(){
+    {
+        std::lock_guard<std::mutex> g(_lock);
+        _quit = true;
+    }
+    _cv.notify_all();
+    for(auto & t : _workers){
+        t.join();
+    }
+}
+
+std::string Resolver::_key(const std::string & host, const AddrInfo & hints,
+                           const std::string & service)
+{
+    auto h = hints.to_hints();
+    std::string k;
+    k.reserve(host.size() + service.size() + 2 + 4 * sizeof(int));
+    k.append(host).push_back('\0');
+    k.append(service).push_back('\0');
+    for(int v : {h.ai_family, h.ai_socktype, h.ai_protocol, h.ai_flags}){
+        k.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+    return k;
+}
+
+Maybe<std::vector<AddrInfo>> Resolver::cached(const std::string & host, const AddrInfo & hints,
+                                              const std::string & service)
+{
+    auto it = _cache.find(_key(host, hints, service));
+    if(it == _cache.end()){
+        return Nothing();
+    }
+    if(it->second.expires <= Clock::now()){
+        _cache.erase(it);
+        return Nothing();
+    }
+    return it->second.addrs;
+}
+
+bool Resolver::resolve(const std::string & host, const AddrInfo & hints,
+                       const std::string & service, Callback cb)
+{
+    auto key = _key(host, hints, service);
+
+    auto it = _cache.find(key);
+    if(it != _cache.end()){
+        if(it->second.expires > Clock::now()){
+            cb(Resolution{0, it->second.addrs});
+            return true;
+        }
+        _cache.erase(it);
+    }
+
+    auto & waiters = _inflight[key];
+    waiters.push_back(std::move(cb));
+    if(waiters.size() > 1){
+        // Same lookup already running
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> g(_lock);
+        _requests.push_back(Request{key, host, service, hints.to_hints()});
+    }
+    _cv.notify_one();
+    return false;
+}
+
+void Resolver::_insert(const std::string & key, const std::vector<AddrInfo> & addrs){
+    const auto now = Clock::now();
+    while(!_order.empty() && (_order.front().first <= now || _cache.size() >= _max_entries)){
+        auto it = _cache.find(_order.front().second);
+        if(it != _cache.end() && it->second.expires == _order.front().first){
+            _cache.erase(it);
+        }
+        _order.pop_front();
+    }
+    const auto expires = now + _ttl;
+    _cache[key] = Entry{expires, addrs};
+    _order.emplace_back(expires, key);
+}
+
+size_t Resolver::process(){
+    _done_fd.consume();
+
+    std::vector<Done> done;
+    {
+        std::lock_guard<std::mutex> g(_lock);
+        done.swap(_done);
+    }
+
+    for(auto & d : done){
+        if(d.res.ok()){
+            _insert(d.key, d.res.addrs);
+        }
+        auto it = _inflight.find(d.key);
+        if(it == _inflight.end()){
+            continue;
+        }
+        auto waiters = std::move(it->second);
+        _inflight.erase(it);
+        for(auto & cb : waiters){
+            cb(d.res);
+        }
+    }
+    return done.size();
+}
+
+void Resolver::_work(){
+    while(true){
+        Request r;
+        {
+            std::unique_lock<std::mutex> g(_lock);
+            _cv.wait(g, [this]{ return _quit || !_requests.empty(); });
+            if(_quit){
+                return;
+            }
+            r = std::move(_requests.front());
+            _requests.pop_front();
+        }
+
+        const char * h = r.host.empty()    ? nullptr : r.host.c_str();
+        const char * s = r.service.empty() ? nullptr : r.service.c_str();
+        struct addrinfo * res = nullptr;
+
+        Done d{std::move(r.key), Resolution{::getaddrinfo(h, s, &r.hints, &res), {}}};
+        if(d.res.error == 0){
+            for(auto * p = res; p != nullptr; p = p->ai_next){
+                try {
+                    d.res.addrs.push_back(AddrInfo::from_struct(p));
+                }
+                catch(std::runtime_error &){
+                    // Family/type/protocol we have no enum for; skip it
+                }
+            }
+            ::freeaddrinfo(res);
+        }
+
+        bool first;
+        {
+            std::lock_guard<std::mutex> g(_lock);
+            first = _done.empty();
+            _done.push_back(std::move(d));
+        }
+        if(first){
+            _done_fd.notify();
+        }
+    }
+}
+
+} // ns inet
+
+} // ns _unix
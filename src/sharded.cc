@@ -0,0 +1,121 @@
+#include <pthread.h>
+#include <sched.h>
+#include <csignal>
+
+#include <iostream>
+#include <stdexcept>
+
+#include <unix/sharded.hpp>
+#include <unix/common.hpp>
+#include <unix/log.hpp>
+
+namespace _unix {
+
+namespace inet {
+
+using namespace _unix::epoll;
+
+ShardedUdpServer::Shard::Shard(Socket && s, size_t i, ShardedUdpServer & srv)
+: sock(std::move(s)), index(i), server(srv)
+{
+    if(!sock.setblocking(false)){
+        throw std::runtime_error("ShardedUdpServer: could not make socket non-blocking");
+    }
+    loop.add(sock, *this, {EpollEventType::Input, EpollEventType::EdgeTrigger});
+    loop.add(tasks);
+}
+
+void ShardedUdpServer::Shard::on_event(const EpollEvent & ev){
+    if(ev & EpollEventType::Input){
+        server._handler(sock, index);
+    }
+}
+
+void ShardedUdpServer::Shard::run(){
+    if(server._pin){
+        auto ncpu = std::thread::hardware_concurrency();
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(index % (ncpu ? ncpu : 1), &set);
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if(ret != 0){
+            UB_WARN("shard " << index << ": pthread_setaffinity_np(): " << _unix::errno_str(ret));
+        }
+    }
+    if(loop.run() < 0){
+        UB_ERROR("shard " << index << ": " << _unix::errno_str(errno));
+    }
+}
+
+ShardedUdpServer::ShardedUdpServer(
+    const std::string & laddr,
+    const std::string & service,
+    Handler handler,
+    size_t shards,
+    bool pin_cpus
+)
+: _handler(std::move(handler)), _pin(pin_cpus)
+{
+    if(shards == 0){
+        shards = std::max(1u, std::thread::hardware_concurrency());
+    }
+    auto first = server_socket_udp(laddr, service, true);
+    if(!first){
+        throw std::runtime_error("ShardedUdpServer: could not create socket for shard 0");
+    }
+    // The others bind to exactly what shard 0 got: the name may resolve to several
+    // addresses, and the service may be 0 (any port)
+    auto bound = first->getsockname();
+    if(!bound){
+        throw std::runtime_error("getsockname(): " + _unix::errno_str(errno));
+    }
+    _shards.emplace_back(new Shard(std::move(*first), 0, *this));
+
+    for(size_t i = 1; i < shards; ++i){
+        Socket s(bound->family(), SocketType::Datagram, Protocol::UDP);
+        if(s.set_reuseport(true) != 0 || s.bind(*bound) != 0){
+            throw std::runtime_error("ShardedUdpServer: could not bind socket for shard "
+                                     + std::to_string(i) + ": " + _unix::errno_str(errno));
+        }
+        _shards.emplace_back(new Shard(std::move(s), i, *this));
+    }
+}
+
+ShardedUdpServer::~ShardedUdpServer(){
+    stop();
+}
+
+void ShardedUdpServer::start(){
+    // Threads inherit the signal mask. Block everything while spawning, so signals
+    // keep being delivered to the calling thread only.
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    for(auto & sh : _shards){
+        if(!sh->thread.joinable()){
+            Shard * p = sh.get();
+            sh->thread = std::thread([p]{ p->run(); });
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+}
+
+void ShardedUdpServer::stop(){
+    for(auto & sh : _shards){
+        if(sh->thread.joinable()){
+            Shard * p = sh.get();
+            sh->tasks.post([p]{ p->loop.stop(); });
+        }
+    }
+    for(auto & sh : _shards){
+        if(sh->thread.joinable()){
+            sh->thread.join();
+        }
+    }
+}
+
+} // ns inet
+
+} // ns _unix
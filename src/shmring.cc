@@ -0,0 +1,299 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <unix/shmring.hpp>
+#include <unix/common.hpp>
+#include <unix/log.hpp>
+
+namespace _unix {
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "the ring indexes are shared between processes, so they must be lock free");
+
+constexpr uint32_t ShmRing::magic;
+constexpr uint32_t ShmRing::version;
+constexpr size_t   ShmRing::record_header;
+constexpr uint32_t ShmRing::wrap_marker;
+constexpr size_t   ShmRing::data_offset;
+
+namespace {
+size_t _round_capacity(size_t n){
+    size_t c = 4096;
+    while(c < n){
+        c <<= 1;
+    }
+    return c;
+}
+} // anon ns
+
+ShmRing::ShmRing(size_t capacity, const std::string & name)
+: _mem(-1), _data_bell(-1), _space_bell(-1), _h(nullptr), _cap(_round_capacity(capacity)),
+  _cached_tail(0), _cached_head(0)
+{
+    _mem = ::memfd_create(name.c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if(_mem < 0){
+        throw std::runtime_error("memfd_create(): " + errno_str(errno));
+    }
+    if(::ftruncate(_mem, data_offset + _cap) != 0){
+        auto e = errno;
+        _close();
+        throw std::runtime_error("ftruncate(): " + errno_str(e));
+    }
+    // The peer cannot resize it under us (which would SIGBUS the other side)
+    if(::fcntl(_mem, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0){
+        UB_WARN("fcntl(F_ADD_SEALS): " << errno_str(errno));
+    }
+    _data_bell  = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    _space_bell = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(_data_bell < 0 || _space_bell < 0){
+        auto e = errno;
+        _close();
+        throw std::runtime_error("eventfd(): " + errno_str(e));
+    }
+    _map(data_offset + _cap);
+
+    // A fresh memfd is zero filled, which is also the initial state of the indexes
+    _h->magic    = magic;
+    _h->version  = version;
+    _h->capacity = _cap;
+}
+
+ShmRing::ShmRing(inet::ReceivedFd && mem, inet::ReceivedFd && data_bell, inet::ReceivedFd && space_bell)
+: _mem(mem.release()), _data_bell(data_bell.release()), _space_bell(space_bell.release()),
+  _h(nullptr), _cap(0), _cached_tail(0), _cached_head(0)
+{
+    struct stat sb;
+    if(::fstat(_mem, &sb) != 0 || size_t(sb.st_size) < data_offset + 4096){
+        _close();
+        throw std::runtime_error("ShmRing: not a ring");
+    }
+    _map(sb.st_size);
+    if(_h->magic != magic || _h->version != version || data_offset + _h->capacity != size_t(sb.st_size)
+       || (_h->capacity & (_h->capacity - 1)) != 0){
+        _close();
+        throw std::runtime_error("ShmRing: not a ring");
+    }
+    _cap         = _h->capacity;
+    _cached_tail = _h->tail.load(std::memory_order_acquire);
+    _cached_head = _h->head.load(std::memory_order_acquire);
+}
+
+ShmRing::~ShmRing(){
+    _close();
+}
+
+void ShmRing::_close(){
+    if(_h){
+        ::munmap(_h, data_offset + _cap);
+    }
+    for(int fd : {_mem, _data_bell, _space_bell}){
+        if(fd >= 0){
+            ::close(fd);
+        }
+    }
+    _h = nullptr;
+    _mem = _data_bell = _space_bell = -1;
+}
+
+ShmRing::ShmRing(ShmRing && o)
+: _mem(o._mem), _data_bell(o._data_bell), _space_bell(o._space_bell), _h(o._h), _cap(o._cap),
+  _cached_tail(o._cached_tail), _cached_head(o._cached_head)
+{
+    o._h = nullptr;
+    o._mem = o._data_bell = o._space_bell = -1;
+}
+
+ShmRing& ShmRing::operator=(ShmRing && o){
+    std::swap(_mem, o._mem);
+    std::swap(_data_bell, o._data_bell);
+    std::swap(_space_bell, o._space_bell);
+    std::swap(_h, o._h);
+    std::swap(_cap, o._cap);
+    std::swap(_cached_tail, o._cached_tail);
+    std::swap(_cached_head, o._cached_head);
+    return *this;
+}
+
+void ShmRing::_map(size_t bytes){
+    void * p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, _mem, 0);
+    if(p == MAP_FAILED){
+        auto e = errno;
+        _close();
+        throw std::runtime_error("mmap(): " + errno_str(e));
+    }
+    _h = static_cast<Header*>(p);
+}
+
+ssize_t ShmRing::send_to(inet::Socket & via) const {
+    inet::ControlMessages c;
+    c.add_fds({_mem, _data_bell, _space_bell});
+    const uint8_t b = 0;
+    return via.sendmsg(&b, 1, c, {inet::SendFlag::NoSignal});
+}
+
+cpp::Maybe<ShmRing> ShmRing::receive_from(inet::Socket & via){
+    uint8_t b;
+    auto r = via.recvmsg(&b, 1, {inet::RecvFlag::CmsgCloseOnExec});
+    if(r.bytes < 0){
+        return cpp::Nothing();
+    }
+    std::vector<inet::ReceivedFd> fds;
+    r.control.take_fds(fds);
+    if(fds.size() != 3){
+        UB_ERROR("ShmRing::receive_from(): expected 3 descriptors, got " << fds.size());
+        errno = EBADMSG;
+        return cpp::Nothing();
+    }
+    try {
+        return ShmRing(std::move(fds[0]), std::move(fds[1]), std::move(fds[2]));
+    }
+    catch (std::runtime_error & e){
+        UB_ERROR("ShmRing::receive_from(): " << e.what());
+        errno = EBADMSG;
+        return cpp::Nothing();
+    }
+}
+
+// The doorbell protocol, one per direction. The sleeper drains the eventfd, sets
+// 'waiting' and then re-checks the ring; the other side publishes its index and
+// then checks 'waiting'. Both with full fences in between, so at least one of them
+// sees the other's write: either the sleeper finds the new index, or the eventfd
+// gets rung.
+//
+// The drain is needed on every arm, even when 'waiting' is still set: the ringer
+// clears it before its write() lands, so a re-arm in between leaves a stale
+// wakeup in the eventfd with 'waiting' set.
+void ShmRing::_arm(std::atomic<uint32_t> & waiting, int bell){
+    uint64_t v;
+    while(::read(bell, &v, sizeof(v)) == sizeof(v)){
+    }
+    waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void ShmRing::_ring(std::atomic<uint32_t> & waiting, int bell){
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(waiting.load(std::memory_order_relaxed) && waiting.exchange(0, std::memory_order_relaxed)){
+        const uint64_t one = 1;
+        if(::write(bell, &one, sizeof(one)) != sizeof(one)){
+            UB_ERROR("ShmRing doorbell: " << errno_str(errno));
+        }
+    }
+}
+
+int ShmRing::_wait(int bell){
+    struct pollfd p = {};
+    p.fd     = bell;
+    p.events = POLLIN;
+    int ret;
+    do {
+        ret = ::poll(&p, 1, -1);
+    } while(ret < 0 && errno == EINTR);
+    // Consume the wakeup, so the eventfd does not stay readable once we are done
+    uint64_t v;
+    while(ret > 0 && ::read(bell, &v, sizeof(v)) == sizeof(v)){
+    }
+    return ret;
+}
+
+ssize_t ShmRing::send(const uint8_t * buf, size_t len, cpp::Flags<inet::SendFlag> fl){
+    if(len > max_message()){
+        errno = EMSGSIZE;
+        return -1;
+    }
+    const size_t rec  = _record(len);
+    const uint64_t head = _h->head.load(std::memory_order_relaxed);
+    const size_t off    = head & (_cap - 1);
+    const size_t contig = _cap - off;
+    // Records do not wrap around; skip the end of the ring if it does not fit there
+    const size_t need   = (rec <= contig) ? rec : contig + rec;
+
+    while(head + need - _cached_tail > _cap){
+        _cached_tail = _h->tail.load(std::memory_order_acquire);
+        if(head + need - _cached_tail <= _cap){
+            break;
+        }
+        _arm(_h->space_waiting, _space_bell);
+        _cached_tail = _h->tail.load(std::memory_order_acquire);
+        if(head + need - _cached_tail <= _cap){
+            break;
+        }
+        if(fl.contains(inet::SendFlag::DontWait)){
+            errno = EAGAIN;
+            return -1;
+        }
+        if(_wait(_space_bell) < 0){
+            return -1;
+        }
+    }
+
+    uint8_t * d = _data();
+    size_t at = off;
+    if(rec > contig){
+        memcpy(d + off, &wrap_marker, sizeof(wrap_marker));
+        at = 0;
+    }
+    const uint32_t n = static_cast<uint32_t>(len);
+    memcpy(d + at, &n, sizeof(n));
+    memcpy(d + at + record_header, buf, len);
+    _h->head.store(head + need, std::memory_order_release);
+
+    _ring(_h->data_waiting, _data_bell);
+    return len;
+}
+
+ssize_t ShmRing::recv(uint8_t * buf, size_t buflen, cpp::Flags<inet::RecvFlag> fl){
+    uint64_t tail = _h->tail.load(std::memory_order_relaxed);
+
+    while(tail == _cached_head){
+        _cached_head = _h->head.load(std::memory_order_acquire);
+        if(tail != _cached_head){
+            break;
+        }
+        _arm(_h->data_waiting, _data_bell);
+        _cached_head = _h->head.load(std::memory_order_acquire);
+        if(tail != _cached_head){
+            break;
+        }
+        if(fl.contains(inet::RecvFlag::DontWait)){
+            errno = EAGAIN;
+            return -1;
+        }
+        if(_wait(_data_bell) < 0){
+            return -1;
+        }
+    }
+
+    const uint8_t * d = _data();
+    size_t off = tail & (_cap - 1);
+    uint32_t len;
+    memcpy(&len, d + off, sizeof(len));
+    if(len == wrap_marker){
+        tail += _cap - off;
+        off = 0;
+        memcpy(&len, d, sizeof(len));
+    }
+    // The peer writes the length; a bad one must not take us outside the ring
+    if(len > max_message() || off + _record(len) > _cap || tail + _record(len) > _cached_head){
+        UB_ERROR("ShmRing::recv(): corrupt record length " << len);
+        errno = EBADMSG;
+        return -1;
+    }
+    const size_t n = std::min<size_t>(len, buflen);
+    memcpy(buf, d + off + record_header, n);
+    _h->tail.store(tail + _record(len), std::memory_order_release);
+
+    _ring(_h->space_waiting, _space_bell);
+    return n;
+}
+
+} // ns _unix
@@ -11,7 +11,9 @@ namespace _unix {
 
 namespace signals {
 
-SigAction::SigAction() : _act{} { }
+SigAction::SigAction(const SigSet & mask) : _act{} {
+    set_mask(mask);
+}
 
 const struct sigaction * SigAction::action() const {
     return &_act;
@@ -37,45 +39,12 @@ void SigAction::set_handler(HandlerType2 h){
     _set_siginfo(true);
 }
 
-void SigAction::_clear() {
-    if(::sigemptyset(&_act.sa_mask) != 0){
-        throw std::runtime_error("sigemptyset() failed: " + _unix::errno_str(errno));
-    }
-}
-void SigAction::_fill() {
-    if(::sigfillset(&_act.sa_mask) != 0){
-        throw std::runtime_error("sigfillset() failed: " + _unix::errno_str(errno));
-    }
-}
-void SigAction::mask_remove(Signal signum) {
-    if(::sigdelset(&_act.sa_mask, cpp::to_underlying(signum)) != 0){
-        throw std::runtime_error("sigaddset() failed: " + _unix::errno_str(errno));
-    }
-}
-void SigAction::mask_add(Signal signum) {
-    if(::sigaddset(&_act.sa_mask, cpp::to_underlying(signum)) != 0){
-        throw std::runtime_error("sigaddset() failed: " + _unix::errno_str(errno));
-    }
-}
-bool SigAction::mask_is_set(Signal signum) const {
-    auto ret = ::sigismember(&_act.sa_mask, cpp::to_underlying(signum));
-    if(ret < 0){
-        throw std::runtime_error("sigaddset() failed: " + _unix::errno_str(errno));
-    }
-    // manuals say that "true" == 1, "false == 0", but what if the value is
-    // something else?
-    return bool(ret);
-}
-void SigAction::set_flags(const std::initializer_list<SigActionFlag> & fl){
-    for(const auto & e : fl){
-        if(e == SigActionFlag::IncludeSigInfo){
-            std::cerr
-                << "WARNING: SigAction::set_flags(): "
-                << "ignoring flag SigActionFlag::IncludeSigInfo (SA_SIGINFO)" << std::endl;
-            continue;
-        }
-        _act.sa_flags |= cpp::to_underlying(e);
+void SigAction::set_flags(cpp::Flags<SigActionFlag> fl){
+    if(fl.contains(SigActionFlag::IncludeSigInfo)){
+        UB_WARN("SigAction::set_flags(): ignoring flag SigActionFlag::IncludeSigInfo (SA_SIGINFO)");
+        fl.remove(SigActionFlag::IncludeSigInfo);
     }
+    _act.sa_flags |= cpp::to_int(fl);
 }
 
 void SigAction::_set_siginfo(bool on){
@@ -112,23 +81,23 @@ std::string SigAction::to_string(int level) const {
         << prefix << "  handler: " << _handler_name() << "\n"
         << prefix << "  masked:  [";
     bool first = true;
-    for(const auto & p : signal_map){
-        if(mask_is_set(p.second)){
+    for(const auto & e : signal_names){
+        if(mask_is_set(e.value)){
             if(!first) {
                 ss << ", ";
             }
-            ss << prefix << _unix::signals::to_string(p.second);
+            ss << e.name;
+            first = false;
         }
-        first = false;
     }
     ss << prefix << "]\n"
         << prefix << "  flags:   [";
 
     first = true;
-    for(const auto & p : sigaction_map){
-        if(_act.sa_flags & p.first){
+    for(const auto & e : sigaction_names){
+        if(_act.sa_flags & cpp::to_underlying(e.value)){
             if(!first) ss << ", ";
-            ss << _unix::signals::to_string(p.second);
+            ss << e.name;
             first = false;
         }
     }
@@ -138,8 +107,8 @@ std::string SigAction::to_string(int level) const {
     return ss.str();
 }
 
-std::string to_string(Signal s) { return signal_names.find(s)->second; }
-std::string to_string(SigActionFlag f) { return sigaction_names.find(f)->second; }
+std::string to_string(Signal s)        { return cpp::enum_to_string(enum_name(s), "Signal", s); }
+std::string to_string(SigActionFlag f) { return cpp::enum_to_string(enum_name(f), "SigActionFlag", f); }
 
 // call sigaction, ignore old action
 int sigaction(Signal signum, const SigAction & newact){
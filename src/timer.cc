@@ -0,0 +1,244 @@
+#include <algorithm>
+
+#include <unix/timer.hpp>
+#include <unix/log.hpp>
+
+namespace _unix {
+
+constexpr unsigned TimerWheel::levels;
+constexpr unsigned TimerWheel::slot_bits;
+constexpr unsigned TimerWheel::slots;
+
+namespace {
+
+constexpr uint64_t never = ~uint64_t(0);
+
+// Move all nodes of 'from' to the (empty) list 'to'
+template <typename L>
+void splice(L & from, L & to){
+    if(from.empty()){
+        return;
+    }
+    to.next = from.next;
+    to.prev = from.prev;
+    to.next->prev = &to;
+    to.prev->next = &to;
+    from.next = from.prev = &from;
+}
+
+} // anon ns
+
+TimerWheel::TimerWheel(NanoSeconds tick, ClockId clock)
+    : _fd(clock)
+    , _advancing(false)
+    , _tick(tick.count() > 0 ? tick : NanoSeconds(1))
+    , _origin(clock_now(clock))
+    , _now(0)
+    , _armed(never)
+    , _count(0)
+    , _bits{}
+{
+}
+
+TimerWheel::~TimerWheel(){
+    // Leave the remaining timers in a state where their destructors are no-ops
+    for(auto & level : _wheel){
+        for(auto & head : level){
+            while(!head.empty()){
+                Timer & t = *head.next->owner;
+                _unlink(t);
+            }
+        }
+    }
+}
+
+uint64_t TimerWheel::_clock_ticks() const {
+    return (clock_now(_fd.clock()) - _origin).count() / _tick.count();
+}
+
+void TimerWheel::schedule(Timer & t, NanoSeconds delay){
+    if(t._wheel){
+        t._wheel->cancel(t);
+    }
+    auto d   = std::max(delay.count(), NanoSeconds::rep(0));
+    auto now = (clock_now(_fd.clock()) - _origin).count();
+
+    // _now only moves in advance(), which nothing calls while the wheel is empty
+    // and the timerfd disarmed. Catch up here, or the next advance() would walk
+    // every round since then.
+    if(_count == 0 && !_advancing){
+        _now = std::max<uint64_t>(_now, now / _tick.count());
+    }
+
+    // Round up: never fire early
+    uint64_t e = (now + d + _tick.count() - 1) / _tick.count();
+
+    t._expires = std::max(e, _now + 1);
+    t._wheel   = this;
+    ++_count;
+    _insert(t);
+
+    if(!_advancing){
+        _rearm();
+    }
+}
+
+void TimerWheel::cancel(Timer & t){
+    if(t._wheel == this){
+        _unlink(t);
+    }
+}
+
+void TimerWheel::_insert(Timer & t){
+    uint64_t delta = t._expires - _now;
+
+    unsigned level = 0;
+    while(level < levels - 1 && delta >= (uint64_t(1) << (slot_bits * (level + 1)))){
+        ++level;
+    }
+    // Beyond the range of the wheel: park it at the far end
+    uint64_t e = t._expires;
+    if(level == levels - 1 && delta >= (uint64_t(1) << (slot_bits * levels))){
+        e = _now + (uint64_t(1) << (slot_bits * levels)) - 1;
+    }
+    unsigned slot = (e >> (slot_bits * level)) & (slots - 1);
+
+    Link & head = _wheel[level][slot];
+    Link & n    = t._link;
+    n.prev = head.prev;
+    n.next = &head;
+    head.prev->next = &n;
+    head.prev = &n;
+
+    t._level = level;
+    t._slot  = slot;
+    _bits[level] |= uint64_t(1) << slot;
+}
+
+void TimerWheel::_unlink(Timer & t){
+    Link & n = t._link;
+    n.prev->next = n.next;
+    n.next->prev = n.prev;
+    n.prev = n.next = &n;
+
+    // Nothing to do if 't' was in a batch being fired: then the slot was emptied
+    // beforehand, or has new timers in it.
+    if(_wheel[t._level][t._slot].empty()){
+        _bits[t._level] &= ~(uint64_t(1) << t._slot);
+    }
+    t._wheel = nullptr;
+    --_count;
+}
+
+// _now just crossed a multiple of 'slots': bring down timers from the levels above
+void TimerWheel::_cascade(){
+    for(unsigned level = 1; level < levels; ++level){
+        unsigned slot = (_now >> (slot_bits * level)) & (slots - 1);
+
+        Link tmp;
+        splice(_wheel[level][slot], tmp);
+        _bits[level] &= ~(uint64_t(1) << slot);
+
+        while(!tmp.empty()){
+            Link & n = *tmp.next;
+            n.prev->next = n.next;
+            n.next->prev = n.prev;
+            _insert(*n.owner);
+        }
+        if(slot != 0){
+            break;
+        }
+    }
+}
+
+size_t TimerWheel::_fire(unsigned slot){
+    // Detach the whole slot first; callbacks may then schedule freely
+    Link batch;
+    splice(_wheel[0][slot], batch);
+    _bits[0] &= ~(uint64_t(1) << slot);
+
+    size_t n = 0;
+    while(!batch.empty()){
+        Timer & t = *batch.next->owner;
+        _unlink(t);
+        ++n;
+        if(t._cb){
+            t._cb(t);
+        }
+    }
+    return n;
+}
+
+size_t TimerWheel::advance(){
+    const uint64_t target = _clock_ticks();
+    size_t fired = 0;
+
+    if(_count == 0){
+        _now = std::max(_now, target);     // nothing to walk through
+    }
+
+    _advancing = true;
+    while(_now < target){
+        // Jump to the next non-empty slot of this round, or to the end of the round
+        uint64_t idx  = _now & (slots - 1);
+        uint64_t mask = (idx == slots - 1) ? 0 : (_bits[0] & (~uint64_t(0) << (idx + 1)));
+        uint64_t next = mask ? (_now & ~uint64_t(slots - 1)) + __builtin_ctzll(mask)
+                             : (_now | (slots - 1)) + 1;
+
+        _now = std::min(next, target);
+        idx  = _now & (slots - 1);
+
+        if(idx == 0){
+            _cascade();
+        }
+        if(_bits[0] & (uint64_t(1) << idx)){
+            fired += _fire(idx);
+        }
+    }
+    _advancing = false;
+
+    _rearm();
+    return fired;
+}
+
+void TimerWheel::on_event(const _unix::epoll::EpollEvent &){
+    _fd.consume();
+    advance();
+}
+
+// Earliest tick at which a slot has to be fired or cascaded
+uint64_t TimerWheel::_next_wakeup() const {
+    if(_count == 0){
+        return never;
+    }
+    uint64_t best = never;
+    for(unsigned level = 0; level < levels; ++level){
+        if(!_bits[level]){
+            continue;
+        }
+        const unsigned shift = slot_bits * level;
+        const uint64_t cur   = (_now >> shift) & (slots - 1);
+        const uint64_t round = _now & ~((uint64_t(1) << (shift + slot_bits)) - 1);
+        const uint64_t above = (cur == slots - 1) ? 0 : (_bits[level] & (~uint64_t(0) << (cur + 1)));
+
+        // Slots up to the current one are next visited in the following round
+        uint64_t slot = above ? __builtin_ctzll(above) : slots + __builtin_ctzll(_bits[level]);
+        best = std::min(best, round + (slot << shift));
+    }
+    return best;
+}
+
+void TimerWheel::_rearm(){
+    uint64_t w = _next_wakeup();
+    if(w == _armed){
+        return;
+    }
+    int ret = (w == never) ? _fd.disarm() : _fd.arm_at(_origin + _tick * w);
+    if(ret < 0){
+        UB_ERROR("timerfd_settime(): " << _unix::errno_str(errno));
+        return;
+    }
+    _armed = w;
+}
+
+} // ns _unix
@@ -0,0 +1,216 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <stdexcept>
+
+#include <unix/uring.hpp>
+#include <unix/common.hpp>
+
+#include <cpp.hpp>
+
+namespace _unix {
+
+namespace uring {
+
+namespace {
+// glibc does not provide wrappers for these
+int _io_uring_setup(unsigned entries, struct io_uring_params * p){
+    return ::syscall(__NR_io_uring_setup, entries, p);
+}
+int _io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags){
+    return ::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+int _io_uring_register(int fd, unsigned opcode, const void * arg, unsigned nr_args){
+    return ::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+template <typename T>
+T * _at(void * base, uint32_t off){
+    return reinterpret_cast<T*>(static_cast<char*>(base) + off);
+}
+} // anon ns
+
+IoUring::IoUring(unsigned entries, cpp::Flags<SetupFlag> fl)
+: _sq{}, _cq{}, _sqes(nullptr), _sq_ptr(MAP_FAILED), _sq_bytes(0),
+  _cq_ptr(MAP_FAILED), _cq_bytes(0), _sqes_bytes(0), _ring_fd(-1)
+{
+    struct io_uring_params p = {};
+    p.flags = cpp::to_int(fl);
+
+    _ring_fd = _io_uring_setup(entries, &p);
+    if(_ring_fd < 0){
+        throw std::runtime_error("io_uring_setup(): " + _unix::errno_str(errno));
+    }
+
+    _sq_bytes   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    _cq_bytes   = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+    _sqes_bytes = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    // With FEAT_SINGLE_MMAP, both rings live in the same mapping
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single){
+        _sq_bytes = _cq_bytes = std::max(_sq_bytes, _cq_bytes);
+    }
+
+    _sq_ptr = ::mmap(nullptr, _sq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     _ring_fd, IORING_OFF_SQ_RING);
+    if(_sq_ptr == MAP_FAILED){
+        auto m = _unix::errno_str(errno);
+        ::close(_ring_fd);
+        throw std::runtime_error("io_uring mmap(SQ): " + m);
+    }
+
+    if(single){
+        _cq_ptr = _sq_ptr;
+    }
+    else {
+        _cq_ptr = ::mmap(nullptr, _cq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         _ring_fd, IORING_OFF_CQ_RING);
+        if(_cq_ptr == MAP_FAILED){
+            auto m = _unix::errno_str(errno);
+            ::munmap(_sq_ptr, _sq_bytes);
+            ::close(_ring_fd);
+            throw std::runtime_error("io_uring mmap(CQ): " + m);
+        }
+    }
+
+    auto * sqes = ::mmap(nullptr, _sqes_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         _ring_fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED){
+        auto m = _unix::errno_str(errno);
+        if(!single){ ::munmap(_cq_ptr, _cq_bytes); }
+        ::munmap(_sq_ptr, _sq_bytes);
+        ::close(_ring_fd);
+        throw std::runtime_error("io_uring mmap(SQEs): " + m);
+    }
+    _sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+    _sq.head     = _at<unsigned>(_sq_ptr, p.sq_off.head);
+    _sq.tail     = _at<unsigned>(_sq_ptr, p.sq_off.tail);
+    _sq.mask     = _at<unsigned>(_sq_ptr, p.sq_off.ring_mask);
+    _sq.entries  = _at<unsigned>(_sq_ptr, p.sq_off.ring_entries);
+    _sq.array    = _at<unsigned>(_sq_ptr, p.sq_off.array);
+    _sq.sqe_head = _sq.sqe_tail = *_sq.tail;
+
+    _cq.head = _at<unsigned>(_cq_ptr, p.cq_off.head);
+    _cq.tail = _at<unsigned>(_cq_ptr, p.cq_off.tail);
+    _cq.mask = _at<unsigned>(_cq_ptr, p.cq_off.ring_mask);
+    _cq.cqes = _at<struct io_uring_cqe>(_cq_ptr, p.cq_off.cqes);
+
+    // SQ array entries map 1:1 to the SQE slots, so publishing is just a tail store
+    for(unsigned i = 0; i < *_sq.entries; ++i){
+        _sq.array[i] = i;
+    }
+}
+
+IoUring::~IoUring(){
+    if(_ring_fd < 0){
+        return;
+    }
+    ::munmap(_sqes, _sqes_bytes);
+    if(_cq_ptr != _sq_ptr){
+        ::munmap(_cq_ptr, _cq_bytes);
+    }
+    ::munmap(_sq_ptr, _sq_bytes);
+    ::close(_ring_fd);
+    _ring_fd = -1;
+}
+
+int IoUring::_enter(unsigned wait_nr){
+    unsigned to_submit = _sq.sqe_tail - _sq.sqe_head;
+    if(to_submit > 0){
+        __atomic_store_n(_sq.tail, _sq.sqe_tail, __ATOMIC_RELEASE);
+        _sq.sqe_head = _sq.sqe_tail;
+    }
+    if(to_submit == 0 && wait_nr == 0){
+        return 0;
+    }
+    unsigned flags = (wait_nr > 0) ? IORING_ENTER_GETEVENTS : 0;
+    int ret;
+    do {
+        ret = _io_uring_enter(_ring_fd, to_submit, wait_nr, flags);
+    } while(ret < 0 && errno == EINTR);
+    return ret;
+}
+
+int IoUring::__register(unsigned opcode, const void * arg, unsigned nr_args){
+    return _io_uring_register(_ring_fd, opcode, arg, nr_args);
+}
+
+int IoUring::register_buffers(const std::vector<struct iovec> & bufs){
+    return __register(IORING_REGISTER_BUFFERS, bufs.data(), bufs.size());
+}
+int IoUring::unregister_buffers(){
+    return __register(IORING_UNREGISTER_BUFFERS, nullptr, 0);
+}
+
+int IoUring::register_files(const std::vector<const _unix::inet::Socket *> & socks){
+    std::vector<int> fds;
+    fds.reserve(socks.size());
+    for(const auto * s : socks){
+        fds.push_back(s->__fd());
+    }
+    return __register(IORING_REGISTER_FILES, fds.data(), fds.size());
+}
+int IoUring::unregister_files(){
+    return __register(IORING_UNREGISTER_FILES, nullptr, 0);
+}
+
+// --------------------------------------
+
+BufferRing::BufferRing(IoUring & ring, uint16_t group, unsigned count, size_t buf_size)
+: _uring(ring), _ring(nullptr), _ring_bytes(count * sizeof(struct io_uring_buf)),
+  _bufs(nullptr), _buf_size(buf_size), _count(count), _mask(count - 1),
+  _tail(0), _pending(0), _group(group)
+{
+    if(count == 0 || count > 32768 || (count & (count - 1)) != 0){
+        throw std::runtime_error("BufferRing: count must be a power of two <= 32768");
+    }
+
+    // The ring must be page aligned
+    auto * r = ::mmap(nullptr, _ring_bytes, PROT_READ | PROT_WRITE,
+                      MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if(r == MAP_FAILED){
+        throw std::runtime_error("BufferRing mmap(): " + _unix::errno_str(errno));
+    }
+    _ring = static_cast<struct io_uring_buf*>(r);
+
+    auto * b = ::mmap(nullptr, count * buf_size, PROT_READ | PROT_WRITE,
+                      MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if(b == MAP_FAILED){
+        auto m = _unix::errno_str(errno);
+        ::munmap(_ring, _ring_bytes);
+        throw std::runtime_error("BufferRing mmap(): " + m);
+    }
+    _bufs = static_cast<uint8_t*>(b);
+
+    struct io_uring_buf_reg reg = {};
+    reg.ring_addr    = reinterpret_cast<uint64_t>(_ring);
+    reg.ring_entries = count;
+    reg.bgid         = group;
+    if(_uring.__register(IORING_REGISTER_PBUF_RING, &reg, 1) < 0){
+        auto m = _unix::errno_str(errno);
+        ::munmap(_bufs, count * buf_size);
+        ::munmap(_ring, _ring_bytes);
+        throw std::runtime_error("IORING_REGISTER_PBUF_RING: " + m);
+    }
+
+    for(unsigned i = 0; i < count; ++i){
+        recycle(i);
+    }
+    publish();
+}
+
+BufferRing::~BufferRing(){
+    struct io_uring_buf_reg reg = {};
+    reg.bgid = _group;
+    _uring.__register(IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    ::munmap(_bufs, _count * _buf_size);
+    ::munmap(_ring, _ring_bytes);
+}
+
+} // ns uring
+
+} // ns _unix
@@ -0,0 +1,141 @@
+#include <gtest/gtest.h>
+
+#include <poll.h>
+
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include <unix/timer.hpp>
+
+using namespace _unix;
+using namespace std::chrono;
+
+namespace {
+
+// Runs the wheel off its timerfd until 'done' or 'limit' has passed
+void run_until(TimerWheel & w, const std::function<bool()> & done,
+               milliseconds limit = milliseconds(2000))
+{
+    const auto until = steady_clock::now() + limit;
+    while(!done() && steady_clock::now() < until){
+        struct pollfd p = {};
+        p.fd     = w.__fd();
+        p.events = POLLIN;
+        if(::poll(&p, 1, 10) == 1){
+            uint64_t v;
+            if(::read(w.__fd(), &v, sizeof(v)) != sizeof(v)){
+                continue;
+            }
+            w.advance();
+        }
+    }
+}
+
+} // anon ns
+
+// With a 1us tick, these delays land on levels 0 to 3 and have to be cascaded
+// down one level at a time
+TEST(TimerWheel, CascadesAcrossLevels){
+    TimerWheel w(microseconds(1));
+    const std::vector<microseconds> delays = {
+        microseconds(20), microseconds(500), microseconds(20000), microseconds(300000)
+    };
+
+    std::vector<Timer> timers(delays.size());
+    std::vector<NanoSeconds> fired(delays.size(), NanoSeconds(0));
+    std::vector<size_t> order;
+
+    const auto start = clock_now(ClockId::Monotonic);
+    for(size_t i = 0; i < delays.size(); ++i){
+        w.schedule(timers[i], delays[i], [&, i](Timer &){
+            fired[i] = clock_now(ClockId::Monotonic);
+            order.push_back(i);
+        });
+    }
+    EXPECT_EQ(w.size(), delays.size());
+
+    run_until(w, [&]{ return order.size() == delays.size(); });
+
+    ASSERT_EQ(order.size(), delays.size());
+    for(size_t i = 0; i < delays.size(); ++i){
+        EXPECT_EQ(order[i], i);
+        EXPECT_GE(fired[i] - start, delays[i]) << "timer " << i << " fired early";
+    }
+    EXPECT_EQ(w.size(), 0u);
+}
+
+TEST(TimerWheel, CancelFromCallback){
+    TimerWheel w(milliseconds(1));
+    Timer later;        // fires in the same batch as 'first'
+    Timer elsewhere;    // due later, in another slot
+    Timer last;
+    int first_calls = 0;
+    bool later_fired = false, elsewhere_fired = false, last_fired = false;
+
+    Timer first([&](Timer &){
+        ++first_calls;
+        later.cancel();
+        w.cancel(elsewhere);
+        EXPECT_FALSE(later.active());
+        EXPECT_FALSE(elsewhere.active());
+    });
+    w.schedule(first,     milliseconds(5));
+    w.schedule(later,     milliseconds(5), [&](Timer &){ later_fired = true; });
+    w.schedule(elsewhere, milliseconds(20), [&](Timer &){ elsewhere_fired = true; });
+    w.schedule(last,      milliseconds(40), [&](Timer &){ last_fired = true; });
+
+    run_until(w, [&]{ return last_fired; });
+
+    EXPECT_EQ(first_calls, 1);
+    EXPECT_FALSE(later_fired);
+    EXPECT_FALSE(elsewhere_fired);
+    EXPECT_TRUE(last_fired);
+    EXPECT_EQ(w.size(), 0u);
+}
+
+TEST(TimerWheel, RescheduleInsideBatch){
+    TimerWheel w(milliseconds(1));
+    Timer a, b;
+    int a_calls = 0, b_calls = 0;
+    NanoSeconds b_fired(0);
+
+    const auto start = clock_now(ClockId::Monotonic);
+    // 'a' fires first and moves 'b', still waiting in the same batch, 30ms ahead;
+    // it also re-arms itself, like a periodic timer
+    w.schedule(a, milliseconds(5), [&](Timer & self){
+        if(++a_calls < 3){
+            w.schedule(self, milliseconds(5));
+        }
+        if(a_calls == 1){
+            w.schedule(b, milliseconds(30));
+        }
+    });
+    w.schedule(b, milliseconds(5), [&](Timer &){
+        ++b_calls;
+        b_fired = clock_now(ClockId::Monotonic);
+    });
+
+    run_until(w, [&]{ return a_calls == 3 && b_calls == 1; });
+
+    EXPECT_EQ(a_calls, 3);
+    EXPECT_EQ(b_calls, 1);
+    EXPECT_GE(b_fired - start, milliseconds(35));
+    EXPECT_EQ(w.size(), 0u);
+}
+
+// The wheel does not tick while empty; the first timer after a pause must still
+// be placed relative to the current time
+TEST(TimerWheel, ScheduleAfterIdle){
+    TimerWheel w(microseconds(1));
+    Timer t;
+    bool fired = false;
+
+    ::usleep(50000);    // ~780 rounds of level 0
+    const auto start = clock_now(ClockId::Monotonic);
+    w.schedule(t, microseconds(200), [&](Timer &){ fired = true; });
+
+    run_until(w, [&]{ return fired; });
+    EXPECT_TRUE(fired);
+    EXPECT_GE(clock_now(ClockId::Monotonic) - start, microseconds(200));
+}